@@ -0,0 +1,2468 @@
+/**
+ * @file chromakey.c
+ * @brief Núcleo de composição do Chroma Key, exposto em `chromakey.h`.
+ *
+ * Contém os kernels de linha (escalar, SSSE3 e AVX2) da chave de cor, do
+ * matte de diferença, das imagens de 16 bits e dos planos separados, a
+ * tabela da chave suave, os filtros do matte e a divisão do trabalho em
+ * bandas de linhas entre threads, tudo atrás de `compor()`, única função
+ * exportada. Não há estado global além da tabela de kernels, escolhida uma
+ * vez por processo, e da última tabela suave, guardada sob mutex; nada
+ * encerra o programa, então o objeto pode ser ligado a outros programas e
+ * chamado de várias threads. O programa de linha de comando
+ * (`chromakeyFinal.c`) compõe todas as imagens por meio de `compor()`.
+ *
+ * @author Társis Barreto
+ * @author Isaque Passos
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chromakeyInterno.h"
+
+#define LUT_BITS 6 /**< Bits por canal na tabela de opacidade (64x64x64). */
+#define ALINHAMENTO 64
+#define FILTRO_EROSAO 0 /**< Filtros do matte (`--erode`, `--dilate`, `--blur`). */
+#define FILTRO_DILATACAO 1
+#define FILTRO_CAIXA 2
+#define COLUNAS_BLOCO_MATTE 2048 /**< Largura dos blocos de coluna da passada vertical. */
+#define TOL_MAXIMA 441 /**< Diagonal do cubo RGB de 8 bits. */
+#define TOL_MAXIMA16 113511 /**< Diagonal do cubo RGB de 16 bits, arredondada para cima. */
+
+/**
+ * @brief Kernel de composição de uma linha de 8 bits.
+ */
+typedef void (*tpKernelLinha)(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const tpChave *chave);
+
+/**
+ * @brief Kernel do matte de diferença: compara cada pixel de `fore` ao de `placa`.
+ */
+typedef void (*tpKernelDiferenca)(tpPixel *saida, const tpPixel *back, const tpPixel *fore, const tpPixel *placa, size_t nCol, const tpChave *chave);
+
+/**
+ * @brief Chave das imagens de 16 bits; a tolerância ao quadrado passa de 32 bits.
+ */
+typedef struct Chave16
+{
+    int R, G, B;
+    long long tolerancia;
+} tpChave16;
+
+/**
+ * @brief Kernel de composição de uma linha de 16 bits.
+ */
+typedef void (*tpKernelLinha16)(tpPixel16 *saida, const tpPixel16 *back, const tpPixel16 *fore, size_t nCol, const tpChave16 *chave);
+
+/**
+ * @brief Imagem em planos separados (R, G e B), cada linha alinhada em 64 bytes.
+ */
+typedef struct ImagemPlanar
+{
+    unsigned char *bloco; /**< Memória alocada, antes do alinhamento. */
+    unsigned char *R, *G, *B;
+    size_t passo; /**< Bytes por linha em cada plano, múltiplo de 64. */
+    size_t nLin, nCol;
+} tpImagemPlanar;
+
+/**
+ * @brief Kernel de composição da linha `i` de imagens planares, nas colunas [colIni, colFim).
+ */
+typedef void (*tpKernelPlanar)(const tpImagemPlanar *saida, const tpImagemPlanar *back, const tpImagemPlanar *fore, size_t i, size_t colIni, size_t colFim, const tpChave *chave);
+
+/**
+ * @brief Kernels de um nível SIMD, escolhidos uma vez por `iniciarKernels()`.
+ */
+typedef struct Kernels
+{
+    tpKernelLinha linha;
+    tpKernelDiferenca diferenca;
+    tpKernelLinha16 linha16;
+    tpKernelPlanar planar;
+    void (*paraPlanar)(const tpPixel *linha, unsigned char *R, unsigned char *G, unsigned char *B, size_t nCol);
+    void (*dePlanar)(tpPixel *linha, const unsigned char *R, const unsigned char *G, const unsigned char *B, size_t nCol);
+    const char *nome, *nome16; /**< Para `tpRelatorio`. */
+} tpKernels;
+
+/**
+ * @brief Tabela de opacidade da chave suave, compartilhada entre chamadas.
+ *
+ * `usos` conta a referência guardada em `tabelaGuardada` e as das chamadas
+ * em andamento; quem a zera libera a tabela.
+ */
+typedef struct TabelaAlfa
+{
+    unsigned char alfa[1 << (3 * LUT_BITS)];
+    int R, G, B, tolInterna, tolExterna;
+    int usos;
+} tpTabelaAlfa;
+
+/**
+ * @brief Parâmetros de uma passada de filtro do matte, repassados às bandas.
+ */
+typedef struct Filtro
+{
+    const unsigned char *origem;
+    unsigned char *destino;
+    size_t nLin, nCol;
+    int tipo, raio;
+    const unsigned char *divisao; /**< Soma da janela -> média arredondada (caixa). */
+} tpFiltro;
+
+/**
+ * @brief Estado de uma chamada de `compor()`, compartilhado pelas threads.
+ *
+ * A região do fundo coberta pelo foreground é [linIni, linFim) x
+ * [colIni, colFim); somados a uma posição do fundo, `desvioLin` e `desvioCol`
+ * dão a do foreground (e da placa de `--plate`).
+ */
+typedef struct Composicao
+{
+    const tpImagem *fore, *back, *placa;
+    const tpImagem *saida;
+    const tpOpcoesChave *opcoes;
+    const tpKernels *kernels;
+    tpChave chave;
+    tpChave16 chave16;
+    const unsigned char *alfa; /**< Tabela da chave suave, ou NULL. */
+    int bits16, diferenca, contar;
+    size_t linIni, linFim, colIni, colFim;
+    long long desvioLin, desvioCol;
+    unsigned char *matte, *matteAux; /**< Opacidade da região sobreposta, linha a linha. */
+    tpImagemPlanar backP, foreP, saidaP;
+    size_t cont[3]; /**< Pixels que receberam fundo, foreground e média. */
+    void (*tarefa)(struct Composicao *c, size_t banda);
+    const tpFiltro *filtro;
+    atomic_size_t proximaBanda;
+    size_t nBandas;
+    pthread_mutex_t mutex;
+    int erro; /**< Alguma banda ficou sem memória. */
+} tpComposicao;
+
+static void comporLinhaEscalar(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const tpChave *chave);
+static void comporDiferencaEscalar(tpPixel *saida, const tpPixel *back, const tpPixel *fore, const tpPixel *placa, size_t nCol, const tpChave *chave);
+static void comporLinhaSuave(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const unsigned char *alfa, int despill);
+static void comporLinha16Escalar(tpPixel16 *saida, const tpPixel16 *back, const tpPixel16 *fore, size_t nCol, const tpChave16 *chave);
+static void paraPlanarEscalar(const tpPixel *linha, unsigned char *R, unsigned char *G, unsigned char *B, size_t nCol);
+static void dePlanarEscalar(tpPixel *linha, const unsigned char *R, const unsigned char *G, const unsigned char *B, size_t nCol);
+static void comporPlanarEscalar(const tpImagemPlanar *saida, const tpImagemPlanar *back, const tpImagemPlanar *fore, size_t i, size_t colIni, size_t colFim, const tpChave *chave);
+#ifdef CHROMA_X86
+static void comporLinhaSSSE3(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const tpChave *chave);
+static void comporLinhaAVX2(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const tpChave *chave);
+static void comporDiferencaSSSE3(tpPixel *saida, const tpPixel *back, const tpPixel *fore, const tpPixel *placa, size_t nCol, const tpChave *chave);
+static void comporDiferencaAVX2(tpPixel *saida, const tpPixel *back, const tpPixel *fore, const tpPixel *placa, size_t nCol, const tpChave *chave);
+static void comporLinha16AVX2(tpPixel16 *saida, const tpPixel16 *back, const tpPixel16 *fore, size_t nCol, const tpChave16 *chave);
+static void paraPlanarSSSE3(const tpPixel *linha, unsigned char *R, unsigned char *G, unsigned char *B, size_t nCol);
+static void dePlanarSSSE3(tpPixel *linha, const unsigned char *R, const unsigned char *G, const unsigned char *B, size_t nCol);
+static void comporPlanarSSE2(const tpImagemPlanar *saida, const tpImagemPlanar *back, const tpImagemPlanar *fore, size_t i, size_t colIni, size_t colFim, const tpChave *chave);
+static void comporPlanarAVX2(const tpImagemPlanar *saida, const tpImagemPlanar *back, const tpImagemPlanar *fore, size_t i, size_t colIni, size_t colFim, const tpChave *chave);
+#endif
+static void iniciarKernels(void);
+static tpTabelaAlfa *obterTabelaAlfa(tpPixel chave, int tolInterna, int tolExterna);
+static void soltarTabelaAlfa(tpTabelaAlfa *tabela);
+static double relogio(void);
+static tpPixel *linhaImagem(const tpImagem *img, size_t i);
+static tpPixel16 *linhaImagem16(const tpImagem *img, size_t i);
+static const tpPixel *linhaPlaca(const tpComposicao *c, size_t i);
+static void posicionar(tpComposicao *c);
+static void *trabalharBandas(void *arg);
+static void repartirBandas(tpComposicao *c, void (*tarefa)(tpComposicao *c, size_t banda), size_t nBandas);
+static void somarContagem(tpComposicao *c, const size_t cont[3]);
+static void copiarFundo(const tpComposicao *c, size_t ini, size_t fim);
+static void contarBanda(tpComposicao *c, size_t banda);
+static void comporBanda(tpComposicao *c, size_t banda);
+static void comporBanda16(tpComposicao *c, size_t banda);
+static int alocarPlanar(tpImagemPlanar *img, size_t nLin, size_t nCol);
+static void converterBandaPlanar(tpComposicao *c, size_t banda);
+static void comporBandaPlanar(tpComposicao *c, size_t banda);
+static void converterBandaSaida(tpComposicao *c, size_t banda);
+static void comporPlanar(tpComposicao *c, size_t nBandas, tpRelatorio *relatorio);
+static void gerarMatteBanda(tpComposicao *c, size_t banda);
+static void estenderLinha(unsigned char *pad, const unsigned char *linha, size_t nCol, int raio);
+static void minimoLinha(unsigned char *dest, const unsigned char *orig, size_t n);
+static void maximoLinha(unsigned char *dest, const unsigned char *orig, size_t n);
+static void deslizarSomas(unsigned short *somas, const unsigned char *entra, const unsigned char *sai, size_t n);
+static void filtrarHorizontalBanda(tpComposicao *c, size_t banda);
+static void filtrarVerticalBanda(tpComposicao *c, size_t banda);
+static void filtrarMatte(tpComposicao *c, int tipo, int raio);
+static void misturarBanda(tpComposicao *c, size_t banda);
+static void comporComMatte(tpComposicao *c, size_t nBandas, tpRelatorio *relatorio);
+static int validarOpcoes(const tpImagem *fore, const tpImagem *back, const tpImagem *saida, const tpOpcoesChave *opcoes);
+
+static tpKernels tabelaKernels[CHROMA_SIMD_AVX2 + 1]; /**< Um conjunto por nível `CHROMA_SIMD_*`. */
+static pthread_once_t kernelsIniciados = PTHREAD_ONCE_INIT;
+static tpTabelaAlfa *tabelaGuardada; /**< Última tabela suave montada, para a próxima chamada com a mesma chave. */
+static pthread_mutex_t mutexTabela = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Aplica o Chroma Key em uma linha, sobre as `nCol` colunas do foreground.
+ *
+ * Pixels mais próximos da chave que a tolerância recebem o fundo, os mais
+ * distantes mantêm o foreground e os que estão exatamente na borda recebem a
+ * média dos dois. A tolerância de `chave` já vem elevada ao quadrado e a
+ * distância é medida no espaço de `chave->espaco`. Com `chave->despill`, o
+ * foreground que vai para a saída (inteiro ou na média) passa antes por
+ * `removerVazamento()`.
+ */
+static void comporLinhaEscalar(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const tpChave *chave)
+{
+    int distancia;
+
+    for (size_t j = 0; j < nCol; j++){
+
+        distancia = distanciaChave(&fore[j], chave);
+
+        if (distancia < chave->tolerancia){
+
+            saida[j] = back[j];
+        }
+
+        else if (distancia > chave->tolerancia){
+
+            saida[j] = removerVazamento(fore[j], chave->despill);
+        }
+
+        else{
+
+            tpPixel atual = removerVazamento(fore[j], chave->despill);
+
+            saida[j].R = (back[j].R + atual.R) / 2;
+            saida[j].G = (back[j].G + atual.G) / 2;
+            saida[j].B = (back[j].B + atual.B) / 2;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Matte de diferença: como `comporLinhaEscalar()`, mas cada pixel do
+ * foreground é comparado ao pixel correspondente da placa limpa.
+ *
+ * Pixels do foreground iguais à placa (dentro da tolerância) são o cenário
+ * vazio e recebem o fundo; os que diferem são o objeto. Só a tolerância e o
+ * espaço de cor de `chave` são usados.
+ */
+static void comporDiferencaEscalar(tpPixel *saida, const tpPixel *back, const tpPixel *fore, const tpPixel *placa, size_t nCol, const tpChave *chave)
+{
+    int distancia;
+
+    for (size_t j = 0; j < nCol; j++){
+
+        distancia = distanciaPixels(&fore[j], &placa[j], chave->espaco);
+
+        if (distancia < chave->tolerancia){
+
+            saida[j] = back[j];
+        }
+
+        else if (distancia > chave->tolerancia){
+
+            saida[j] = fore[j];
+        }
+
+        else{
+
+            tpPixel atual = fore[j];
+
+            saida[j].R = (back[j].R + atual.R) / 2;
+            saida[j].G = (back[j].G + atual.G) / 2;
+            saida[j].B = (back[j].B + atual.B) / 2;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+#ifdef CHROMA_X86
+
+/*
+ * Máscara de `pshufb` que replica uma máscara de 16 pixels (um byte por
+ * pixel) de volta ao layout RGB intercalado, em três registradores.
+ */
+static const signed char expandir[3][16] = {
+    { 0,  0,  0,  1,  1,  1,  2,  2,  2,  3,  3,  3,  4,  4,  4,  5},
+    { 5,  5,  6,  6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10},
+    {10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15}
+};
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão SSSE3 de `comporLinhaEscalar()`, 16 pixels por iteração.
+ *
+ * Os canais são separados com `pshufb`, as distâncias calculadas em 32 bits
+ * com `pmaddwd` e as máscaras "menor" e "maior" são replicadas para o layout
+ * intercalado. A média da borda usa `pavgb` corrigido para arredondar para
+ * baixo, como a divisão inteira da versão escalar.
+ */
+__attribute__((target("ssse3")))
+static void comporLinhaSSSE3(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const tpChave *chave)
+{
+    const unsigned char *f = (const unsigned char *)fore;
+    const unsigned char *b = (const unsigned char *)back;
+    unsigned char *s = (unsigned char *)saida;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i um = _mm_set1_epi8(1);
+    const __m128i kR = _mm_set1_epi16(chave->R);
+    const __m128i kG = _mm_set1_epi16(chave->G);
+    const __m128i kB = _mm_set1_epi16(chave->B);
+    const __m128i kCb = _mm_set1_epi16(chave->Cb);
+    const __m128i kCr = _mm_set1_epi16(chave->Cr);
+    const __m128i tol = _mm_set1_epi32(chave->tolerancia);
+    const int crominancia = chave->espaco == ESPACO_CBCR;
+    __m128i shR[3], shG[3], shB[3], shE[3], foraDom[3];
+    size_t j = 0;
+
+    for (int v = 0; v < 3; v++){
+
+        unsigned char m[16];
+
+        for (int k = 0; k < 16; k++) m[k] = (16 * v + k) % 3 == chave->despill ? 0 : 0xFF;
+
+        shR[v] = _mm_loadu_si128((const __m128i *)desintR[v]);
+        shG[v] = _mm_loadu_si128((const __m128i *)desintG[v]);
+        shB[v] = _mm_loadu_si128((const __m128i *)desintB[v]);
+        shE[v] = _mm_loadu_si128((const __m128i *)expandir[v]);
+        foraDom[v] = _mm_loadu_si128((const __m128i *)m);
+    }
+
+    for (; j + 16 <= nCol; j += 16){
+
+        __m128i fv[3], r, g, bl, rl, rh, gl, gh, bb, bh, d[4], menor, maior;
+
+        for (int v = 0; v < 3; v++) fv[v] = _mm_loadu_si128((const __m128i *)(f + 3 * j + 16 * v));
+
+        r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(fv[0], shR[0]), _mm_shuffle_epi8(fv[1], shR[1])), _mm_shuffle_epi8(fv[2], shR[2]));
+        g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(fv[0], shG[0]), _mm_shuffle_epi8(fv[1], shG[1])), _mm_shuffle_epi8(fv[2], shG[2]));
+        bl = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(fv[0], shB[0]), _mm_shuffle_epi8(fv[1], shB[1])), _mm_shuffle_epi8(fv[2], shB[2]));
+
+        if (crominancia){
+
+            /* Cb e Cr em 16 bits, como em calcularCb() e calcularCr(); a soma dos quadrados em 32. */
+            __m128i cb[2], cr[2];
+
+            rl = _mm_unpacklo_epi8(r, zero);
+            rh = _mm_unpackhi_epi8(r, zero);
+            gl = _mm_unpacklo_epi8(g, zero);
+            gh = _mm_unpackhi_epi8(g, zero);
+            bb = _mm_unpacklo_epi8(bl, zero);
+            bh = _mm_unpackhi_epi8(bl, zero);
+
+            cb[0] = _mm_sub_epi16(_mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rl, _mm_set1_epi16(-43)), _mm_mullo_epi16(gl, _mm_set1_epi16(-85))), _mm_slli_epi16(bb, 7)), 8), kCb);
+            cb[1] = _mm_sub_epi16(_mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(rh, _mm_set1_epi16(-43)), _mm_mullo_epi16(gh, _mm_set1_epi16(-85))), _mm_slli_epi16(bh, 7)), 8), kCb);
+            cr[0] = _mm_sub_epi16(_mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(_mm_slli_epi16(rl, 7), _mm_mullo_epi16(gl, _mm_set1_epi16(107))), _mm_mullo_epi16(bb, _mm_set1_epi16(21))), 8), kCr);
+            cr[1] = _mm_sub_epi16(_mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(_mm_slli_epi16(rh, 7), _mm_mullo_epi16(gh, _mm_set1_epi16(107))), _mm_mullo_epi16(bh, _mm_set1_epi16(21))), 8), kCr);
+
+            d[0] = _mm_unpacklo_epi16(cb[0], cr[0]);
+            d[1] = _mm_unpackhi_epi16(cb[0], cr[0]);
+            d[2] = _mm_unpacklo_epi16(cb[1], cr[1]);
+            d[3] = _mm_unpackhi_epi16(cb[1], cr[1]);
+
+            for (int k = 0; k < 4; k++) d[k] = _mm_madd_epi16(d[k], d[k]);
+        }
+
+        else{
+
+            rl = _mm_sub_epi16(_mm_unpacklo_epi8(r, zero), kR);
+            rh = _mm_sub_epi16(_mm_unpackhi_epi8(r, zero), kR);
+            gl = _mm_sub_epi16(_mm_unpacklo_epi8(g, zero), kG);
+            gh = _mm_sub_epi16(_mm_unpackhi_epi8(g, zero), kG);
+            bb = _mm_sub_epi16(_mm_unpacklo_epi8(bl, zero), kB);
+            bh = _mm_sub_epi16(_mm_unpackhi_epi8(bl, zero), kB);
+
+            d[0] = _mm_unpacklo_epi16(rl, gl);
+            d[1] = _mm_unpackhi_epi16(rl, gl);
+            d[2] = _mm_unpacklo_epi16(rh, gh);
+            d[3] = _mm_unpackhi_epi16(rh, gh);
+
+            d[0] = _mm_add_epi32(_mm_madd_epi16(d[0], d[0]), _mm_madd_epi16(_mm_unpacklo_epi16(bb, zero), _mm_unpacklo_epi16(bb, zero)));
+            d[1] = _mm_add_epi32(_mm_madd_epi16(d[1], d[1]), _mm_madd_epi16(_mm_unpackhi_epi16(bb, zero), _mm_unpackhi_epi16(bb, zero)));
+            d[2] = _mm_add_epi32(_mm_madd_epi16(d[2], d[2]), _mm_madd_epi16(_mm_unpacklo_epi16(bh, zero), _mm_unpacklo_epi16(bh, zero)));
+            d[3] = _mm_add_epi32(_mm_madd_epi16(d[3], d[3]), _mm_madd_epi16(_mm_unpackhi_epi16(bh, zero), _mm_unpackhi_epi16(bh, zero)));
+        }
+
+        menor = _mm_packs_epi16(_mm_packs_epi32(_mm_cmpgt_epi32(tol, d[0]), _mm_cmpgt_epi32(tol, d[1])),
+                                _mm_packs_epi32(_mm_cmpgt_epi32(tol, d[2]), _mm_cmpgt_epi32(tol, d[3])));
+        maior = _mm_packs_epi16(_mm_packs_epi32(_mm_cmpgt_epi32(d[0], tol), _mm_cmpgt_epi32(d[1], tol)),
+                                _mm_packs_epi32(_mm_cmpgt_epi32(d[2], tol), _mm_cmpgt_epi32(d[3], tol)));
+
+        /*
+         * Despill: o limite (maior dos outros dois canais) é expandido para a
+         * posição do canal dominante e 0xFF nas demais, e um min por byte
+         * limita só aquele canal.
+         */
+        if (chave->despill >= 0){
+
+            __m128i limite = chave->despill == 0 ? _mm_max_epu8(g, bl) : chave->despill == 1 ? _mm_max_epu8(r, bl) : _mm_max_epu8(r, g);
+
+            for (int v = 0; v < 3; v++) fv[v] = _mm_min_epu8(fv[v], _mm_or_si128(_mm_shuffle_epi8(limite, shE[v]), foraDom[v]));
+        }
+
+        for (int v = 0; v < 3; v++){
+
+            __m128i bv = _mm_loadu_si128((const __m128i *)(b + 3 * j + 16 * v));
+            __m128i mMenor = _mm_shuffle_epi8(menor, shE[v]);
+            __m128i mMaior = _mm_shuffle_epi8(maior, shE[v]);
+            __m128i media = _mm_sub_epi8(_mm_avg_epu8(bv, fv[v]), _mm_and_si128(_mm_xor_si128(bv, fv[v]), um));
+            __m128i res = _mm_or_si128(_mm_or_si128(_mm_and_si128(mMenor, bv), _mm_and_si128(mMaior, fv[v])),
+                                       _mm_andnot_si128(_mm_or_si128(mMenor, mMaior), media));
+
+            _mm_storeu_si128((__m128i *)(s + 3 * j + 16 * v), res);
+        }
+    }
+
+    comporLinhaEscalar(saida + j, back + j, fore + j, nCol - j, chave);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão AVX2 de `comporLinhaEscalar()`, 32 pixels por iteração.
+ *
+ * Cada metade de 128 bits dos registradores carrega um grupo de 16 pixels, e
+ * como todas as instruções usadas operam por metade, o algoritmo é o mesmo da
+ * versão SSSE3.
+ */
+__attribute__((target("avx2")))
+static void comporLinhaAVX2(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const tpChave *chave)
+{
+    const unsigned char *f = (const unsigned char *)fore;
+    const unsigned char *b = (const unsigned char *)back;
+    unsigned char *s = (unsigned char *)saida;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i um = _mm256_set1_epi8(1);
+    const __m256i kR = _mm256_set1_epi16(chave->R);
+    const __m256i kG = _mm256_set1_epi16(chave->G);
+    const __m256i kB = _mm256_set1_epi16(chave->B);
+    const __m256i kCb = _mm256_set1_epi16(chave->Cb);
+    const __m256i kCr = _mm256_set1_epi16(chave->Cr);
+    const __m256i tol = _mm256_set1_epi32(chave->tolerancia);
+    const int crominancia = chave->espaco == ESPACO_CBCR;
+    __m256i shR[3], shG[3], shB[3], shE[3], foraDom[3];
+    size_t j = 0;
+
+    for (int v = 0; v < 3; v++){
+
+        unsigned char m[16];
+
+        for (int k = 0; k < 16; k++) m[k] = (16 * v + k) % 3 == chave->despill ? 0 : 0xFF;
+
+        shR[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)desintR[v]));
+        shG[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)desintG[v]));
+        shB[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)desintB[v]));
+        shE[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)expandir[v]));
+        foraDom[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m));
+    }
+
+    for (; j + 32 <= nCol; j += 32){
+
+        __m256i fv[3], r, g, bl, rl, rh, gl, gh, bb, bh, d[4], menor, maior;
+
+        for (int v = 0; v < 3; v++){
+
+            fv[v] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(f + 3 * j + 16 * v))),
+                                            _mm_loadu_si128((const __m128i *)(f + 3 * j + 48 + 16 * v)), 1);
+        }
+
+        r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(fv[0], shR[0]), _mm256_shuffle_epi8(fv[1], shR[1])), _mm256_shuffle_epi8(fv[2], shR[2]));
+        g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(fv[0], shG[0]), _mm256_shuffle_epi8(fv[1], shG[1])), _mm256_shuffle_epi8(fv[2], shG[2]));
+        bl = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(fv[0], shB[0]), _mm256_shuffle_epi8(fv[1], shB[1])), _mm256_shuffle_epi8(fv[2], shB[2]));
+
+        if (crominancia){
+
+            /* Como na versão SSSE3, por metade de 128 bits. */
+            __m256i cb[2], cr[2];
+
+            rl = _mm256_unpacklo_epi8(r, zero);
+            rh = _mm256_unpackhi_epi8(r, zero);
+            gl = _mm256_unpacklo_epi8(g, zero);
+            gh = _mm256_unpackhi_epi8(g, zero);
+            bb = _mm256_unpacklo_epi8(bl, zero);
+            bh = _mm256_unpackhi_epi8(bl, zero);
+
+            cb[0] = _mm256_sub_epi16(_mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(rl, _mm256_set1_epi16(-43)), _mm256_mullo_epi16(gl, _mm256_set1_epi16(-85))), _mm256_slli_epi16(bb, 7)), 8), kCb);
+            cb[1] = _mm256_sub_epi16(_mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(rh, _mm256_set1_epi16(-43)), _mm256_mullo_epi16(gh, _mm256_set1_epi16(-85))), _mm256_slli_epi16(bh, 7)), 8), kCb);
+            cr[0] = _mm256_sub_epi16(_mm256_srai_epi16(_mm256_sub_epi16(_mm256_sub_epi16(_mm256_slli_epi16(rl, 7), _mm256_mullo_epi16(gl, _mm256_set1_epi16(107))), _mm256_mullo_epi16(bb, _mm256_set1_epi16(21))), 8), kCr);
+            cr[1] = _mm256_sub_epi16(_mm256_srai_epi16(_mm256_sub_epi16(_mm256_sub_epi16(_mm256_slli_epi16(rh, 7), _mm256_mullo_epi16(gh, _mm256_set1_epi16(107))), _mm256_mullo_epi16(bh, _mm256_set1_epi16(21))), 8), kCr);
+
+            d[0] = _mm256_unpacklo_epi16(cb[0], cr[0]);
+            d[1] = _mm256_unpackhi_epi16(cb[0], cr[0]);
+            d[2] = _mm256_unpacklo_epi16(cb[1], cr[1]);
+            d[3] = _mm256_unpackhi_epi16(cb[1], cr[1]);
+
+            for (int k = 0; k < 4; k++) d[k] = _mm256_madd_epi16(d[k], d[k]);
+        }
+
+        else{
+
+            rl = _mm256_sub_epi16(_mm256_unpacklo_epi8(r, zero), kR);
+            rh = _mm256_sub_epi16(_mm256_unpackhi_epi8(r, zero), kR);
+            gl = _mm256_sub_epi16(_mm256_unpacklo_epi8(g, zero), kG);
+            gh = _mm256_sub_epi16(_mm256_unpackhi_epi8(g, zero), kG);
+            bb = _mm256_sub_epi16(_mm256_unpacklo_epi8(bl, zero), kB);
+            bh = _mm256_sub_epi16(_mm256_unpackhi_epi8(bl, zero), kB);
+
+            d[0] = _mm256_unpacklo_epi16(rl, gl);
+            d[1] = _mm256_unpackhi_epi16(rl, gl);
+            d[2] = _mm256_unpacklo_epi16(rh, gh);
+            d[3] = _mm256_unpackhi_epi16(rh, gh);
+
+            d[0] = _mm256_add_epi32(_mm256_madd_epi16(d[0], d[0]), _mm256_madd_epi16(_mm256_unpacklo_epi16(bb, zero), _mm256_unpacklo_epi16(bb, zero)));
+            d[1] = _mm256_add_epi32(_mm256_madd_epi16(d[1], d[1]), _mm256_madd_epi16(_mm256_unpackhi_epi16(bb, zero), _mm256_unpackhi_epi16(bb, zero)));
+            d[2] = _mm256_add_epi32(_mm256_madd_epi16(d[2], d[2]), _mm256_madd_epi16(_mm256_unpacklo_epi16(bh, zero), _mm256_unpacklo_epi16(bh, zero)));
+            d[3] = _mm256_add_epi32(_mm256_madd_epi16(d[3], d[3]), _mm256_madd_epi16(_mm256_unpackhi_epi16(bh, zero), _mm256_unpackhi_epi16(bh, zero)));
+        }
+
+        menor = _mm256_packs_epi16(_mm256_packs_epi32(_mm256_cmpgt_epi32(tol, d[0]), _mm256_cmpgt_epi32(tol, d[1])),
+                                   _mm256_packs_epi32(_mm256_cmpgt_epi32(tol, d[2]), _mm256_cmpgt_epi32(tol, d[3])));
+        maior = _mm256_packs_epi16(_mm256_packs_epi32(_mm256_cmpgt_epi32(d[0], tol), _mm256_cmpgt_epi32(d[1], tol)),
+                                   _mm256_packs_epi32(_mm256_cmpgt_epi32(d[2], tol), _mm256_cmpgt_epi32(d[3], tol)));
+
+        if (chave->despill >= 0){
+
+            __m256i limite = chave->despill == 0 ? _mm256_max_epu8(g, bl) : chave->despill == 1 ? _mm256_max_epu8(r, bl) : _mm256_max_epu8(r, g);
+
+            for (int v = 0; v < 3; v++) fv[v] = _mm256_min_epu8(fv[v], _mm256_or_si256(_mm256_shuffle_epi8(limite, shE[v]), foraDom[v]));
+        }
+
+        for (int v = 0; v < 3; v++){
+
+            __m256i bv = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(b + 3 * j + 16 * v))),
+                                                 _mm_loadu_si128((const __m128i *)(b + 3 * j + 48 + 16 * v)), 1);
+            __m256i mMenor = _mm256_shuffle_epi8(menor, shE[v]);
+            __m256i mMaior = _mm256_shuffle_epi8(maior, shE[v]);
+            __m256i media = _mm256_sub_epi8(_mm256_avg_epu8(bv, fv[v]), _mm256_and_si256(_mm256_xor_si256(bv, fv[v]), um));
+            __m256i res = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(mMenor, bv), _mm256_and_si256(mMaior, fv[v])),
+                                          _mm256_andnot_si256(_mm256_or_si256(mMenor, mMaior), media));
+
+            _mm_storeu_si128((__m128i *)(s + 3 * j + 16 * v), _mm256_castsi256_si128(res));
+            _mm_storeu_si128((__m128i *)(s + 3 * j + 48 + 16 * v), _mm256_extracti128_si256(res, 1));
+        }
+    }
+
+    comporLinhaSSSE3(saida + j, back + j, fore + j, nCol - j, chave);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão SSSE3 de `comporDiferencaEscalar()`, 16 pixels por iteração.
+ *
+ * Igual a `comporLinhaSSSE3()`, com a chave constante trocada pelos canais da
+ * placa, separados pelas mesmas máscaras: o custo extra é uma carga e três
+ * `pshufb` por registrador.
+ */
+__attribute__((target("ssse3")))
+static void comporDiferencaSSSE3(tpPixel *saida, const tpPixel *back, const tpPixel *fore, const tpPixel *placa, size_t nCol, const tpChave *chave)
+{
+    const unsigned char *f = (const unsigned char *)fore;
+    const unsigned char *b = (const unsigned char *)back;
+    const unsigned char *p = (const unsigned char *)placa;
+    unsigned char *s = (unsigned char *)saida;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i um = _mm_set1_epi8(1);
+    const __m128i tol = _mm_set1_epi32(chave->tolerancia);
+    const int crominancia = chave->espaco == ESPACO_CBCR;
+    __m128i shR[3], shG[3], shB[3], shE[3];
+    size_t j = 0;
+
+    for (int v = 0; v < 3; v++){
+
+        shR[v] = _mm_loadu_si128((const __m128i *)desintR[v]);
+        shG[v] = _mm_loadu_si128((const __m128i *)desintG[v]);
+        shB[v] = _mm_loadu_si128((const __m128i *)desintB[v]);
+        shE[v] = _mm_loadu_si128((const __m128i *)expandir[v]);
+    }
+
+    for (; j + 16 <= nCol; j += 16){
+
+        __m128i fv[3], pv[3], c[2][6], d[4], menor, maior;
+
+        for (int v = 0; v < 3; v++){
+
+            fv[v] = _mm_loadu_si128((const __m128i *)(f + 3 * j + 16 * v));
+            pv[v] = _mm_loadu_si128((const __m128i *)(p + 3 * j + 16 * v));
+        }
+
+        /* c[0] é o foreground e c[1] a placa: R, G e B em 16 bits, metades baixa e alta. */
+        for (int k = 0; k < 2; k++){
+
+            const __m128i *x = k == 0 ? fv : pv;
+            __m128i r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x[0], shR[0]), _mm_shuffle_epi8(x[1], shR[1])), _mm_shuffle_epi8(x[2], shR[2]));
+            __m128i g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x[0], shG[0]), _mm_shuffle_epi8(x[1], shG[1])), _mm_shuffle_epi8(x[2], shG[2]));
+            __m128i bl = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x[0], shB[0]), _mm_shuffle_epi8(x[1], shB[1])), _mm_shuffle_epi8(x[2], shB[2]));
+
+            c[k][0] = _mm_unpacklo_epi8(r, zero);
+            c[k][1] = _mm_unpackhi_epi8(r, zero);
+            c[k][2] = _mm_unpacklo_epi8(g, zero);
+            c[k][3] = _mm_unpackhi_epi8(g, zero);
+            c[k][4] = _mm_unpacklo_epi8(bl, zero);
+            c[k][5] = _mm_unpackhi_epi8(bl, zero);
+
+            if (crominancia){
+
+                /* Troca R, G, B por Cb e Cr, como em calcularCb() e calcularCr(). */
+                for (int h = 0; h < 2; h++){
+
+                    __m128i cb = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(c[k][h], _mm_set1_epi16(-43)), _mm_mullo_epi16(c[k][2 + h], _mm_set1_epi16(-85))), _mm_slli_epi16(c[k][4 + h], 7)), 8);
+                    __m128i cr = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(_mm_slli_epi16(c[k][h], 7), _mm_mullo_epi16(c[k][2 + h], _mm_set1_epi16(107))), _mm_mullo_epi16(c[k][4 + h], _mm_set1_epi16(21))), 8);
+
+                    c[k][h] = cb;
+                    c[k][2 + h] = cr;
+                    c[k][4 + h] = zero;
+                }
+            }
+        }
+
+        for (int k = 0; k < 6; k++) c[0][k] = _mm_sub_epi16(c[0][k], c[1][k]);
+
+        d[0] = _mm_unpacklo_epi16(c[0][0], c[0][2]);
+        d[1] = _mm_unpackhi_epi16(c[0][0], c[0][2]);
+        d[2] = _mm_unpacklo_epi16(c[0][1], c[0][3]);
+        d[3] = _mm_unpackhi_epi16(c[0][1], c[0][3]);
+
+        d[0] = _mm_add_epi32(_mm_madd_epi16(d[0], d[0]), _mm_madd_epi16(_mm_unpacklo_epi16(c[0][4], zero), _mm_unpacklo_epi16(c[0][4], zero)));
+        d[1] = _mm_add_epi32(_mm_madd_epi16(d[1], d[1]), _mm_madd_epi16(_mm_unpackhi_epi16(c[0][4], zero), _mm_unpackhi_epi16(c[0][4], zero)));
+        d[2] = _mm_add_epi32(_mm_madd_epi16(d[2], d[2]), _mm_madd_epi16(_mm_unpacklo_epi16(c[0][5], zero), _mm_unpacklo_epi16(c[0][5], zero)));
+        d[3] = _mm_add_epi32(_mm_madd_epi16(d[3], d[3]), _mm_madd_epi16(_mm_unpackhi_epi16(c[0][5], zero), _mm_unpackhi_epi16(c[0][5], zero)));
+
+        menor = _mm_packs_epi16(_mm_packs_epi32(_mm_cmpgt_epi32(tol, d[0]), _mm_cmpgt_epi32(tol, d[1])),
+                                _mm_packs_epi32(_mm_cmpgt_epi32(tol, d[2]), _mm_cmpgt_epi32(tol, d[3])));
+        maior = _mm_packs_epi16(_mm_packs_epi32(_mm_cmpgt_epi32(d[0], tol), _mm_cmpgt_epi32(d[1], tol)),
+                                _mm_packs_epi32(_mm_cmpgt_epi32(d[2], tol), _mm_cmpgt_epi32(d[3], tol)));
+
+        for (int v = 0; v < 3; v++){
+
+            __m128i bv = _mm_loadu_si128((const __m128i *)(b + 3 * j + 16 * v));
+            __m128i mMenor = _mm_shuffle_epi8(menor, shE[v]);
+            __m128i mMaior = _mm_shuffle_epi8(maior, shE[v]);
+            __m128i media = _mm_sub_epi8(_mm_avg_epu8(bv, fv[v]), _mm_and_si128(_mm_xor_si128(bv, fv[v]), um));
+            __m128i res = _mm_or_si128(_mm_or_si128(_mm_and_si128(mMenor, bv), _mm_and_si128(mMaior, fv[v])),
+                                       _mm_andnot_si128(_mm_or_si128(mMenor, mMaior), media));
+
+            _mm_storeu_si128((__m128i *)(s + 3 * j + 16 * v), res);
+        }
+    }
+
+    comporDiferencaEscalar(saida + j, back + j, fore + j, placa + j, nCol - j, chave);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão AVX2 de `comporDiferencaEscalar()`, 32 pixels por iteração.
+ */
+__attribute__((target("avx2")))
+static void comporDiferencaAVX2(tpPixel *saida, const tpPixel *back, const tpPixel *fore, const tpPixel *placa, size_t nCol, const tpChave *chave)
+{
+    const unsigned char *f = (const unsigned char *)fore;
+    const unsigned char *b = (const unsigned char *)back;
+    const unsigned char *p = (const unsigned char *)placa;
+    unsigned char *s = (unsigned char *)saida;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i um = _mm256_set1_epi8(1);
+    const __m256i tol = _mm256_set1_epi32(chave->tolerancia);
+    const int crominancia = chave->espaco == ESPACO_CBCR;
+    __m256i shR[3], shG[3], shB[3], shE[3];
+    size_t j = 0;
+
+    for (int v = 0; v < 3; v++){
+
+        shR[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)desintR[v]));
+        shG[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)desintG[v]));
+        shB[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)desintB[v]));
+        shE[v] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)expandir[v]));
+    }
+
+    for (; j + 32 <= nCol; j += 32){
+
+        __m256i fv[3], pv[3], c[2][6], d[4], menor, maior;
+
+        for (int v = 0; v < 3; v++){
+
+            fv[v] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(f + 3 * j + 16 * v))),
+                                            _mm_loadu_si128((const __m128i *)(f + 3 * j + 48 + 16 * v)), 1);
+            pv[v] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p + 3 * j + 16 * v))),
+                                            _mm_loadu_si128((const __m128i *)(p + 3 * j + 48 + 16 * v)), 1);
+        }
+
+        for (int k = 0; k < 2; k++){
+
+            const __m256i *x = k == 0 ? fv : pv;
+            __m256i r = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(x[0], shR[0]), _mm256_shuffle_epi8(x[1], shR[1])), _mm256_shuffle_epi8(x[2], shR[2]));
+            __m256i g = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(x[0], shG[0]), _mm256_shuffle_epi8(x[1], shG[1])), _mm256_shuffle_epi8(x[2], shG[2]));
+            __m256i bl = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(x[0], shB[0]), _mm256_shuffle_epi8(x[1], shB[1])), _mm256_shuffle_epi8(x[2], shB[2]));
+
+            c[k][0] = _mm256_unpacklo_epi8(r, zero);
+            c[k][1] = _mm256_unpackhi_epi8(r, zero);
+            c[k][2] = _mm256_unpacklo_epi8(g, zero);
+            c[k][3] = _mm256_unpackhi_epi8(g, zero);
+            c[k][4] = _mm256_unpacklo_epi8(bl, zero);
+            c[k][5] = _mm256_unpackhi_epi8(bl, zero);
+
+            if (crominancia){
+
+                for (int h = 0; h < 2; h++){
+
+                    __m256i cb = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(c[k][h], _mm256_set1_epi16(-43)), _mm256_mullo_epi16(c[k][2 + h], _mm256_set1_epi16(-85))), _mm256_slli_epi16(c[k][4 + h], 7)), 8);
+                    __m256i cr = _mm256_srai_epi16(_mm256_sub_epi16(_mm256_sub_epi16(_mm256_slli_epi16(c[k][h], 7), _mm256_mullo_epi16(c[k][2 + h], _mm256_set1_epi16(107))), _mm256_mullo_epi16(c[k][4 + h], _mm256_set1_epi16(21))), 8);
+
+                    c[k][h] = cb;
+                    c[k][2 + h] = cr;
+                    c[k][4 + h] = zero;
+                }
+            }
+        }
+
+        for (int k = 0; k < 6; k++) c[0][k] = _mm256_sub_epi16(c[0][k], c[1][k]);
+
+        d[0] = _mm256_unpacklo_epi16(c[0][0], c[0][2]);
+        d[1] = _mm256_unpackhi_epi16(c[0][0], c[0][2]);
+        d[2] = _mm256_unpacklo_epi16(c[0][1], c[0][3]);
+        d[3] = _mm256_unpackhi_epi16(c[0][1], c[0][3]);
+
+        d[0] = _mm256_add_epi32(_mm256_madd_epi16(d[0], d[0]), _mm256_madd_epi16(_mm256_unpacklo_epi16(c[0][4], zero), _mm256_unpacklo_epi16(c[0][4], zero)));
+        d[1] = _mm256_add_epi32(_mm256_madd_epi16(d[1], d[1]), _mm256_madd_epi16(_mm256_unpackhi_epi16(c[0][4], zero), _mm256_unpackhi_epi16(c[0][4], zero)));
+        d[2] = _mm256_add_epi32(_mm256_madd_epi16(d[2], d[2]), _mm256_madd_epi16(_mm256_unpacklo_epi16(c[0][5], zero), _mm256_unpacklo_epi16(c[0][5], zero)));
+        d[3] = _mm256_add_epi32(_mm256_madd_epi16(d[3], d[3]), _mm256_madd_epi16(_mm256_unpackhi_epi16(c[0][5], zero), _mm256_unpackhi_epi16(c[0][5], zero)));
+
+        menor = _mm256_packs_epi16(_mm256_packs_epi32(_mm256_cmpgt_epi32(tol, d[0]), _mm256_cmpgt_epi32(tol, d[1])),
+                                   _mm256_packs_epi32(_mm256_cmpgt_epi32(tol, d[2]), _mm256_cmpgt_epi32(tol, d[3])));
+        maior = _mm256_packs_epi16(_mm256_packs_epi32(_mm256_cmpgt_epi32(d[0], tol), _mm256_cmpgt_epi32(d[1], tol)),
+                                   _mm256_packs_epi32(_mm256_cmpgt_epi32(d[2], tol), _mm256_cmpgt_epi32(d[3], tol)));
+
+        for (int v = 0; v < 3; v++){
+
+            __m256i bv = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(b + 3 * j + 16 * v))),
+                                                 _mm_loadu_si128((const __m128i *)(b + 3 * j + 48 + 16 * v)), 1);
+            __m256i mMenor = _mm256_shuffle_epi8(menor, shE[v]);
+            __m256i mMaior = _mm256_shuffle_epi8(maior, shE[v]);
+            __m256i media = _mm256_sub_epi8(_mm256_avg_epu8(bv, fv[v]), _mm256_and_si256(_mm256_xor_si256(bv, fv[v]), um));
+            __m256i res = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(mMenor, bv), _mm256_and_si256(mMaior, fv[v])),
+                                          _mm256_andnot_si256(_mm256_or_si256(mMenor, mMaior), media));
+
+            _mm_storeu_si128((__m128i *)(s + 3 * j + 16 * v), _mm256_castsi256_si128(res));
+            _mm_storeu_si128((__m128i *)(s + 3 * j + 48 + 16 * v), _mm256_extracti128_si256(res, 1));
+        }
+    }
+
+    comporDiferencaSSSE3(saida + j, back + j, fore + j, placa + j, nCol - j, chave);
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão suave de `comporLinhaEscalar()`: uma consulta à tabela e uma mistura.
+ *
+ * A chave já está embutida em `alfa`; `despill` é o canal a limitar ou -1.
+ */
+static void comporLinhaSuave(tpPixel *saida, const tpPixel *back, const tpPixel *fore, size_t nCol, const unsigned char *alfa, int despill)
+{
+    const int desloc = 8 - LUT_BITS;
+
+    for (size_t j = 0; j < nCol; j++){
+
+        int a = alfa[(((fore[j].R >> desloc) << LUT_BITS | (fore[j].G >> desloc)) << LUT_BITS) | (fore[j].B >> desloc)];
+
+        tpPixel atual;
+
+        if (a == 0){
+
+            saida[j] = back[j];
+            continue;
+        }
+
+        atual = removerVazamento(fore[j], despill);
+
+        if (a == 255) saida[j] = atual;
+        else{
+
+            saida[j].R = (atual.R * a + back[j].R * (255 - a) + 127) / 255;
+            saida[j].G = (atual.G * a + back[j].G * (255 - a) + 127) / 255;
+            saida[j].B = (atual.B * a + back[j].B * (255 - a) + 127) / 255;
+        }
+    }
+}
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão de `comporLinhaEscalar()` para canais de 16 bits.
+ *
+ * Cada diferença ao quadrado chega a 65535², então a soma dos três canais é
+ * feita em 64 bits, com a tolerância de `chave` já elevada ao quadrado.
+ */
+static void comporLinha16Escalar(tpPixel16 *saida, const tpPixel16 *back, const tpPixel16 *fore, size_t nCol, const tpChave16 *chave)
+{
+    for (size_t j = 0; j < nCol; j++){
+
+        long long dR = fore[j].R - chave->R;
+        long long dG = fore[j].G - chave->G;
+        long long dB = fore[j].B - chave->B;
+        long long distancia = dR * dR + dG * dG + dB * dB;
+
+        if (distancia < chave->tolerancia){
+
+            saida[j] = back[j];
+        }
+
+        else if (distancia > chave->tolerancia){
+
+            saida[j] = fore[j];
+        }
+
+        else{
+
+            saida[j].R = (back[j].R + fore[j].R) / 2;
+            saida[j].G = (back[j].G + fore[j].G) / 2;
+            saida[j].B = (back[j].B + fore[j].B) / 2;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+#ifdef CHROMA_X86
+
+/*
+ * Equivalentes de `desintR`, `desintG`, `desintB` e `expandir` para 8 pixels de 16 bits por canal (48
+ * bytes em três registradores): cada canal ocupa um par de bytes.
+ */
+static const signed char desint16R[3][16] = {
+    { 0,  1,  6,  7, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1,  2,  3,  8,  9, 14, 15, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  4,  5, 10, 11}
+};
+
+static const signed char desint16G[3][16] = {
+    { 2,  3,  8,  9, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1,  4,  5, 10, 11, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  1,  6,  7, 12, 13}
+};
+
+static const signed char desint16B[3][16] = {
+    { 4,  5, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1,  0,  1,  6,  7, 12, 13, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  3,  8,  9, 14, 15}
+};
+
+static const signed char expandir16[3][16] = {
+    { 0,  1,  0,  1,  0,  1,  2,  3,  2,  3,  2,  3,  4,  5,  4,  5},
+    { 4,  5,  6,  7,  6,  7,  6,  7,  8,  9,  8,  9,  8,  9, 10, 11},
+    {10, 11, 10, 11, 12, 13, 12, 13, 12, 13, 14, 15, 14, 15, 14, 15}
+};
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão AVX2 de `comporLinha16Escalar()`, 8 pixels por iteração.
+ *
+ * Os canais são separados com `pshufb` e as diferenças convertidas para
+ * `double`: os quadrados (até 2^32) e a soma (até 2^34) são exatos na mantissa
+ * de 53 bits, então a comparação com a tolerância, inclusive a igualdade da
+ * borda, é a mesma da versão escalar. As máscaras voltam para 16 bits e são
+ * replicadas para o layout intercalado, como na versão de 8 bits.
+ */
+__attribute__((target("avx2")))
+static void comporLinha16AVX2(tpPixel16 *saida, const tpPixel16 *back, const tpPixel16 *fore, size_t nCol, const tpChave16 *chave)
+{
+    const unsigned short *f = (const unsigned short *)fore;
+    const unsigned short *b = (const unsigned short *)back;
+    unsigned short *s = (unsigned short *)saida;
+    const __m128i um = _mm_set1_epi16(1);
+    const __m256i kR = _mm256_set1_epi32(chave->R);
+    const __m256i kG = _mm256_set1_epi32(chave->G);
+    const __m256i kB = _mm256_set1_epi32(chave->B);
+    const __m256i pares = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256d tol = _mm256_set1_pd((double)chave->tolerancia);
+    __m128i shR[3], shG[3], shB[3], shE[3];
+    size_t j = 0;
+
+    for (int v = 0; v < 3; v++){
+
+        shR[v] = _mm_loadu_si128((const __m128i *)desint16R[v]);
+        shG[v] = _mm_loadu_si128((const __m128i *)desint16G[v]);
+        shB[v] = _mm_loadu_si128((const __m128i *)desint16B[v]);
+        shE[v] = _mm_loadu_si128((const __m128i *)expandir16[v]);
+    }
+
+    for (; j + 8 <= nCol; j += 8){
+
+        __m128i fv[3], r, g, bl, menor, maior;
+        __m128i mMenor[2], mMaior[2];
+        __m256i dr, dg, db;
+
+        for (int v = 0; v < 3; v++) fv[v] = _mm_loadu_si128((const __m128i *)(f + 3 * j + 8 * v));
+
+        r = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(fv[0], shR[0]), _mm_shuffle_epi8(fv[1], shR[1])), _mm_shuffle_epi8(fv[2], shR[2]));
+        g = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(fv[0], shG[0]), _mm_shuffle_epi8(fv[1], shG[1])), _mm_shuffle_epi8(fv[2], shG[2]));
+        bl = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(fv[0], shB[0]), _mm_shuffle_epi8(fv[1], shB[1])), _mm_shuffle_epi8(fv[2], shB[2]));
+
+        dr = _mm256_sub_epi32(_mm256_cvtepu16_epi32(r), kR);
+        dg = _mm256_sub_epi32(_mm256_cvtepu16_epi32(g), kG);
+        db = _mm256_sub_epi32(_mm256_cvtepu16_epi32(bl), kB);
+
+        for (int h = 0; h < 2; h++){
+
+            __m256d x = _mm256_cvtepi32_pd(h == 0 ? _mm256_castsi256_si128(dr) : _mm256_extracti128_si256(dr, 1));
+            __m256d y = _mm256_cvtepi32_pd(h == 0 ? _mm256_castsi256_si128(dg) : _mm256_extracti128_si256(dg, 1));
+            __m256d z = _mm256_cvtepi32_pd(h == 0 ? _mm256_castsi256_si128(db) : _mm256_extracti128_si256(db, 1));
+            __m256d d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)), _mm256_mul_pd(z, z));
+
+            mMenor[h] = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(_mm256_cmp_pd(d, tol, _CMP_LT_OQ)), pares));
+            mMaior[h] = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(_mm256_cmp_pd(d, tol, _CMP_GT_OQ)), pares));
+        }
+
+        menor = _mm_packs_epi32(mMenor[0], mMenor[1]);
+        maior = _mm_packs_epi32(mMaior[0], mMaior[1]);
+
+        for (int v = 0; v < 3; v++){
+
+            __m128i bv = _mm_loadu_si128((const __m128i *)(b + 3 * j + 8 * v));
+            __m128i eMenor = _mm_shuffle_epi8(menor, shE[v]);
+            __m128i eMaior = _mm_shuffle_epi8(maior, shE[v]);
+            __m128i media = _mm_sub_epi16(_mm_avg_epu16(bv, fv[v]), _mm_and_si128(_mm_xor_si128(bv, fv[v]), um));
+            __m128i res = _mm_or_si128(_mm_or_si128(_mm_and_si128(eMenor, bv), _mm_and_si128(eMaior, fv[v])),
+                                       _mm_andnot_si128(_mm_or_si128(eMenor, eMaior), media));
+
+            _mm_storeu_si128((__m128i *)(s + 3 * j + 8 * v), res);
+        }
+    }
+
+    comporLinha16Escalar(saida + j, back + j, fore + j, nCol - j, chave);
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Separa uma linha de pixels intercalados nos planos R, G e B.
+ */
+static void paraPlanarEscalar(const tpPixel *linha, unsigned char *R, unsigned char *G, unsigned char *B, size_t nCol)
+{
+    for (size_t j = 0; j < nCol; j++){
+
+        R[j] = linha[j].R;
+        G[j] = linha[j].G;
+        B[j] = linha[j].B;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Junta os planos R, G e B de uma linha em pixels intercalados.
+ */
+static void dePlanarEscalar(tpPixel *linha, const unsigned char *R, const unsigned char *G, const unsigned char *B, size_t nCol)
+{
+    for (size_t j = 0; j < nCol; j++){
+
+        linha[j].R = R[j];
+        linha[j].G = G[j];
+        linha[j].B = B[j];
+    }
+}
+
+#ifdef CHROMA_X86
+
+/*
+ * Máscaras de `pshufb` que levam 16 bytes de cada plano para as três partes
+ * de 16 bytes de 16 pixels intercalados.
+ */
+static const signed char intercR[3][16] = {
+    { 0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5},
+    {-1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1},
+    {-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1}
+};
+
+static const signed char intercG[3][16] = {
+    {-1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1},
+    { 5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10},
+    {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1}
+};
+
+static const signed char intercB[3][16] = {
+    {-1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1},
+    {-1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1},
+    {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}
+};
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão SSSE3 de `paraPlanarEscalar()`, com as máscaras de `comporLinhaSSSE3()`.
+ */
+__attribute__((target("ssse3")))
+static void paraPlanarSSSE3(const tpPixel *linha, unsigned char *R, unsigned char *G, unsigned char *B, size_t nCol)
+{
+    const unsigned char *p = (const unsigned char *)linha;
+    size_t j = 0;
+
+    for (; j + 16 <= nCol; j += 16){
+
+        __m128i v[3], r, g, b;
+
+        for (int k = 0; k < 3; k++) v[k] = _mm_loadu_si128((const __m128i *)(p + 3 * j + 16 * k));
+
+        r = g = b = _mm_setzero_si128();
+
+        for (int k = 0; k < 3; k++){
+
+            r = _mm_or_si128(r, _mm_shuffle_epi8(v[k], _mm_loadu_si128((const __m128i *)desintR[k])));
+            g = _mm_or_si128(g, _mm_shuffle_epi8(v[k], _mm_loadu_si128((const __m128i *)desintG[k])));
+            b = _mm_or_si128(b, _mm_shuffle_epi8(v[k], _mm_loadu_si128((const __m128i *)desintB[k])));
+        }
+
+        _mm_storeu_si128((__m128i *)(R + j), r);
+        _mm_storeu_si128((__m128i *)(G + j), g);
+        _mm_storeu_si128((__m128i *)(B + j), b);
+    }
+
+    paraPlanarEscalar(linha + j, R + j, G + j, B + j, nCol - j);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão SSSE3 de `dePlanarEscalar()`.
+ */
+__attribute__((target("ssse3")))
+static void dePlanarSSSE3(tpPixel *linha, const unsigned char *R, const unsigned char *G, const unsigned char *B, size_t nCol)
+{
+    unsigned char *p = (unsigned char *)linha;
+    size_t j = 0;
+
+    for (; j + 16 <= nCol; j += 16){
+
+        __m128i r = _mm_loadu_si128((const __m128i *)(R + j));
+        __m128i g = _mm_loadu_si128((const __m128i *)(G + j));
+        __m128i b = _mm_loadu_si128((const __m128i *)(B + j));
+
+        for (int k = 0; k < 3; k++){
+
+            __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, _mm_loadu_si128((const __m128i *)intercR[k])),
+                                                  _mm_shuffle_epi8(g, _mm_loadu_si128((const __m128i *)intercG[k]))),
+                                     _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)intercB[k])));
+
+            _mm_storeu_si128((__m128i *)(p + 3 * j + 16 * k), v);
+        }
+    }
+
+    dePlanarEscalar(linha + j, R + j, G + j, B + j, nCol - j);
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Aplica o Chroma Key à linha `i` de imagens planares, nas colunas [colIni, colFim).
+ */
+static void comporPlanarEscalar(const tpImagemPlanar *saida, const tpImagemPlanar *back, const tpImagemPlanar *fore, size_t i, size_t colIni, size_t colFim, const tpChave *chave)
+{
+    size_t lf = (size_t)i * fore->passo, lb = (size_t)i * back->passo, ls = (size_t)i * saida->passo;
+
+    for (size_t j = colIni; j < colFim; j++){
+
+        int dr = fore->R[lf + j] - chave->R;
+        int dg = fore->G[lf + j] - chave->G;
+        int db = fore->B[lf + j] - chave->B;
+        int distancia = dr * dr + dg * dg + db * db;
+
+        if (distancia < chave->tolerancia){
+
+            saida->R[ls + j] = back->R[lb + j];
+            saida->G[ls + j] = back->G[lb + j];
+            saida->B[ls + j] = back->B[lb + j];
+        }
+
+        else if (distancia > chave->tolerancia){
+
+            saida->R[ls + j] = fore->R[lf + j];
+            saida->G[ls + j] = fore->G[lf + j];
+            saida->B[ls + j] = fore->B[lf + j];
+        }
+
+        else{
+
+            saida->R[ls + j] = (back->R[lb + j] + fore->R[lf + j]) / 2;
+            saida->G[ls + j] = (back->G[lb + j] + fore->G[lf + j]) / 2;
+            saida->B[ls + j] = (back->B[lb + j] + fore->B[lf + j]) / 2;
+        }
+    }
+}
+
+#ifdef CHROMA_X86
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão SSE2 de `comporPlanarEscalar()`, 16 pixels por iteração.
+ *
+ * Como os canais já estão separados e as linhas alinhadas, não há
+ * embaralhamento: as cargas são alinhadas e o laço começa no bloco de 16 que
+ * contém `colIni` e pode ir até o fim do bloco que contém `colFim`, pois o
+ * preenchimento existe e as colunas excedentes da saída são sobrescritas em
+ * seguida pelo background.
+ */
+__attribute__((target("sse2")))
+static void comporPlanarSSE2(const tpImagemPlanar *saida, const tpImagemPlanar *back, const tpImagemPlanar *fore, size_t i, size_t colIni, size_t colFim, const tpChave *chave)
+{
+    size_t lf = (size_t)i * fore->passo, lb = (size_t)i * back->passo, ls = (size_t)i * saida->passo;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i um = _mm_set1_epi8(1);
+    const __m128i kR = _mm_set1_epi16(chave->R);
+    const __m128i kG = _mm_set1_epi16(chave->G);
+    const __m128i kB = _mm_set1_epi16(chave->B);
+    const __m128i tol = _mm_set1_epi32(chave->tolerancia);
+    const unsigned char *fp[3] = {fore->R + lf, fore->G + lf, fore->B + lf};
+    const unsigned char *bp[3] = {back->R + lb, back->G + lb, back->B + lb};
+    unsigned char *sp[3] = {saida->R + ls, saida->G + ls, saida->B + ls};
+
+    for (size_t j = colIni & ~15; j < colFim; j += 16){
+
+        __m128i r = _mm_load_si128((const __m128i *)(fp[0] + j));
+        __m128i g = _mm_load_si128((const __m128i *)(fp[1] + j));
+        __m128i b = _mm_load_si128((const __m128i *)(fp[2] + j));
+        __m128i rl = _mm_sub_epi16(_mm_unpacklo_epi8(r, zero), kR);
+        __m128i rh = _mm_sub_epi16(_mm_unpackhi_epi8(r, zero), kR);
+        __m128i gl = _mm_sub_epi16(_mm_unpacklo_epi8(g, zero), kG);
+        __m128i gh = _mm_sub_epi16(_mm_unpackhi_epi8(g, zero), kG);
+        __m128i bl = _mm_sub_epi16(_mm_unpacklo_epi8(b, zero), kB);
+        __m128i bh = _mm_sub_epi16(_mm_unpackhi_epi8(b, zero), kB);
+        __m128i d[4], menor, maior;
+
+        d[0] = _mm_unpacklo_epi16(rl, gl);
+        d[1] = _mm_unpackhi_epi16(rl, gl);
+        d[2] = _mm_unpacklo_epi16(rh, gh);
+        d[3] = _mm_unpackhi_epi16(rh, gh);
+
+        d[0] = _mm_add_epi32(_mm_madd_epi16(d[0], d[0]), _mm_madd_epi16(_mm_unpacklo_epi16(bl, zero), _mm_unpacklo_epi16(bl, zero)));
+        d[1] = _mm_add_epi32(_mm_madd_epi16(d[1], d[1]), _mm_madd_epi16(_mm_unpackhi_epi16(bl, zero), _mm_unpackhi_epi16(bl, zero)));
+        d[2] = _mm_add_epi32(_mm_madd_epi16(d[2], d[2]), _mm_madd_epi16(_mm_unpacklo_epi16(bh, zero), _mm_unpacklo_epi16(bh, zero)));
+        d[3] = _mm_add_epi32(_mm_madd_epi16(d[3], d[3]), _mm_madd_epi16(_mm_unpackhi_epi16(bh, zero), _mm_unpackhi_epi16(bh, zero)));
+
+        menor = _mm_packs_epi16(_mm_packs_epi32(_mm_cmpgt_epi32(tol, d[0]), _mm_cmpgt_epi32(tol, d[1])),
+                                _mm_packs_epi32(_mm_cmpgt_epi32(tol, d[2]), _mm_cmpgt_epi32(tol, d[3])));
+        maior = _mm_packs_epi16(_mm_packs_epi32(_mm_cmpgt_epi32(d[0], tol), _mm_cmpgt_epi32(d[1], tol)),
+                                _mm_packs_epi32(_mm_cmpgt_epi32(d[2], tol), _mm_cmpgt_epi32(d[3], tol)));
+
+        for (int c = 0; c < 3; c++){
+
+            __m128i fv = _mm_load_si128((const __m128i *)(fp[c] + j));
+            __m128i bv = _mm_load_si128((const __m128i *)(bp[c] + j));
+            __m128i media = _mm_sub_epi8(_mm_avg_epu8(bv, fv), _mm_and_si128(_mm_xor_si128(bv, fv), um));
+            __m128i res = _mm_or_si128(_mm_or_si128(_mm_and_si128(menor, bv), _mm_and_si128(maior, fv)),
+                                       _mm_andnot_si128(_mm_or_si128(menor, maior), media));
+
+            _mm_store_si128((__m128i *)(sp[c] + j), res);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão AVX2 de `comporPlanarEscalar()`, 32 pixels por iteração.
+ *
+ * As instruções de empacotamento do AVX2 trabalham por metade de 128 bits, mas
+ * como desempacotamento e empacotamento usam a mesma ordem, as máscaras voltam
+ * alinhadas aos pixels sem permutação.
+ */
+__attribute__((target("avx2")))
+static void comporPlanarAVX2(const tpImagemPlanar *saida, const tpImagemPlanar *back, const tpImagemPlanar *fore, size_t i, size_t colIni, size_t colFim, const tpChave *chave)
+{
+    size_t lf = (size_t)i * fore->passo, lb = (size_t)i * back->passo, ls = (size_t)i * saida->passo;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i um = _mm256_set1_epi8(1);
+    const __m256i kR = _mm256_set1_epi16(chave->R);
+    const __m256i kG = _mm256_set1_epi16(chave->G);
+    const __m256i kB = _mm256_set1_epi16(chave->B);
+    const __m256i tol = _mm256_set1_epi32(chave->tolerancia);
+    const unsigned char *fp[3] = {fore->R + lf, fore->G + lf, fore->B + lf};
+    const unsigned char *bp[3] = {back->R + lb, back->G + lb, back->B + lb};
+    unsigned char *sp[3] = {saida->R + ls, saida->G + ls, saida->B + ls};
+
+    for (size_t j = colIni & ~31; j < colFim; j += 32){
+
+        __m256i r = _mm256_load_si256((const __m256i *)(fp[0] + j));
+        __m256i g = _mm256_load_si256((const __m256i *)(fp[1] + j));
+        __m256i b = _mm256_load_si256((const __m256i *)(fp[2] + j));
+        __m256i rl = _mm256_sub_epi16(_mm256_unpacklo_epi8(r, zero), kR);
+        __m256i rh = _mm256_sub_epi16(_mm256_unpackhi_epi8(r, zero), kR);
+        __m256i gl = _mm256_sub_epi16(_mm256_unpacklo_epi8(g, zero), kG);
+        __m256i gh = _mm256_sub_epi16(_mm256_unpackhi_epi8(g, zero), kG);
+        __m256i bl = _mm256_sub_epi16(_mm256_unpacklo_epi8(b, zero), kB);
+        __m256i bh = _mm256_sub_epi16(_mm256_unpackhi_epi8(b, zero), kB);
+        __m256i d[4], menor, maior;
+
+        d[0] = _mm256_unpacklo_epi16(rl, gl);
+        d[1] = _mm256_unpackhi_epi16(rl, gl);
+        d[2] = _mm256_unpacklo_epi16(rh, gh);
+        d[3] = _mm256_unpackhi_epi16(rh, gh);
+
+        d[0] = _mm256_add_epi32(_mm256_madd_epi16(d[0], d[0]), _mm256_madd_epi16(_mm256_unpacklo_epi16(bl, zero), _mm256_unpacklo_epi16(bl, zero)));
+        d[1] = _mm256_add_epi32(_mm256_madd_epi16(d[1], d[1]), _mm256_madd_epi16(_mm256_unpackhi_epi16(bl, zero), _mm256_unpackhi_epi16(bl, zero)));
+        d[2] = _mm256_add_epi32(_mm256_madd_epi16(d[2], d[2]), _mm256_madd_epi16(_mm256_unpacklo_epi16(bh, zero), _mm256_unpacklo_epi16(bh, zero)));
+        d[3] = _mm256_add_epi32(_mm256_madd_epi16(d[3], d[3]), _mm256_madd_epi16(_mm256_unpackhi_epi16(bh, zero), _mm256_unpackhi_epi16(bh, zero)));
+
+        menor = _mm256_packs_epi16(_mm256_packs_epi32(_mm256_cmpgt_epi32(tol, d[0]), _mm256_cmpgt_epi32(tol, d[1])),
+                                   _mm256_packs_epi32(_mm256_cmpgt_epi32(tol, d[2]), _mm256_cmpgt_epi32(tol, d[3])));
+        maior = _mm256_packs_epi16(_mm256_packs_epi32(_mm256_cmpgt_epi32(d[0], tol), _mm256_cmpgt_epi32(d[1], tol)),
+                                   _mm256_packs_epi32(_mm256_cmpgt_epi32(d[2], tol), _mm256_cmpgt_epi32(d[3], tol)));
+
+        for (int c = 0; c < 3; c++){
+
+            __m256i fv = _mm256_load_si256((const __m256i *)(fp[c] + j));
+            __m256i bv = _mm256_load_si256((const __m256i *)(bp[c] + j));
+            __m256i media = _mm256_sub_epi8(_mm256_avg_epu8(bv, fv), _mm256_and_si256(_mm256_xor_si256(bv, fv), um));
+            __m256i res = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(menor, bv), _mm256_and_si256(maior, fv)),
+                                          _mm256_andnot_si256(_mm256_or_si256(menor, maior), media));
+
+            _mm256_store_si256((__m256i *)(sp[c] + j), res);
+        }
+    }
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Monta `tabelaKernels`, uma vez por processo, por `pthread_once()`.
+ *
+ * Para cada nível `CHROMA_SIMD_*`, fica o melhor kernel que o processador
+ * suporta sem passar do nível; um nível não suportado é rebaixado, para que o
+ * mesmo executável funcione em qualquer máquina. O processador é consultado
+ * só aqui, e não a cada chamada de `compor()`.
+ */
+static void iniciarKernels(void)
+{
+    int temSSE2 = 0, temSSSE3 = 0, temAVX2 = 0;
+
+#ifdef CHROMA_X86
+    temSSE2 = __builtin_cpu_supports("sse2");
+    temSSSE3 = __builtin_cpu_supports("ssse3");
+    temAVX2 = __builtin_cpu_supports("avx2");
+#endif
+
+    for (int nivel = CHROMA_SIMD_AUTO; nivel <= CHROMA_SIMD_AVX2; nivel++){
+
+        tpKernels *k = &tabelaKernels[nivel];
+        int vetor = nivel != CHROMA_SIMD_ESCALAR;
+        int avx2 = temAVX2 && (nivel == CHROMA_SIMD_AUTO || nivel == CHROMA_SIMD_AVX2);
+
+        k->linha = comporLinhaEscalar;
+        k->diferenca = comporDiferencaEscalar;
+        k->linha16 = comporLinha16Escalar;
+        k->planar = comporPlanarEscalar;
+        k->paraPlanar = paraPlanarEscalar;
+        k->dePlanar = dePlanarEscalar;
+        k->nome = k->nome16 = "escalar";
+
+#ifdef CHROMA_X86
+        if (vetor && temSSE2) k->planar = comporPlanarSSE2;
+
+        if (vetor && temSSSE3){
+
+            k->linha = comporLinhaSSSE3;
+            k->diferenca = comporDiferencaSSSE3;
+            k->paraPlanar = paraPlanarSSSE3;
+            k->dePlanar = dePlanarSSSE3;
+            k->nome = "ssse3";
+        }
+
+        if (avx2){
+
+            k->linha = comporLinhaAVX2;
+            k->diferenca = comporDiferencaAVX2;
+            k->linha16 = comporLinha16AVX2;
+            k->planar = comporPlanarAVX2;
+            k->nome = k->nome16 = "avx2";
+        }
+#else
+        (void)vetor;
+        (void)avx2;
+        (void)temSSE2;
+        (void)temSSSE3;
+#endif
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Tabela de opacidade da chave suave para cada célula do RGB quantizado.
+ *
+ * A distância é medida do centro de cada célula até a chave: até
+ * `tolInterna` a opacidade é 0, a partir de `tolExterna` é 255 e entre as
+ * duas cresce linearmente. Montar a tabela custa mais que compor uma linha,
+ * então a última fica guardada e é reaproveitada enquanto a chave e as
+ * tolerâncias forem as mesmas (quadro a quadro, ou linha a linha em
+ * `--stream`). Cada chamada solta a sua com `soltarTabelaAlfa()`. Devolve
+ * NULL sem memória.
+ */
+static tpTabelaAlfa *obterTabelaAlfa(tpPixel chave, int tolInterna, int tolExterna)
+{
+    const int celulas = 1 << LUT_BITS;
+    const int passo = 256 >> LUT_BITS;
+    tpTabelaAlfa *t;
+
+    pthread_mutex_lock(&mutexTabela);
+    t = tabelaGuardada;
+
+    if (t != NULL && t->R == chave.R && t->G == chave.G && t->B == chave.B && t->tolInterna == tolInterna && t->tolExterna == tolExterna){
+
+        t->usos++;
+        pthread_mutex_unlock(&mutexTabela);
+        return t;
+    }
+
+    pthread_mutex_unlock(&mutexTabela);
+
+    t = (tpTabelaAlfa *)malloc(sizeof(tpTabelaAlfa));
+
+    if (t == NULL) return NULL;
+
+    for (int r = 0; r < celulas; r++){
+        for (int g = 0; g < celulas; g++){
+            for (int b = 0; b < celulas; b++){
+
+                double dr = r * passo + (passo - 1) / 2.0 - chave.R;
+                double dg = g * passo + (passo - 1) / 2.0 - chave.G;
+                double db = b * passo + (passo - 1) / 2.0 - chave.B;
+                double d = sqrt(dr * dr + dg * dg + db * db);
+                int alfa;
+
+                if (d <= tolInterna) alfa = 0;
+                else if (d >= tolExterna) alfa = 255;
+                else alfa = (int)(255.0 * (d - tolInterna) / (tolExterna - tolInterna) + 0.5);
+
+                t->alfa[((r << LUT_BITS) | g) << LUT_BITS | b] = alfa;
+            }
+        }
+    }
+
+    t->R = chave.R;
+    t->G = chave.G;
+    t->B = chave.B;
+    t->tolInterna = tolInterna;
+    t->tolExterna = tolExterna;
+    t->usos = 2; /* A guardada e a desta chamada. */
+
+    pthread_mutex_lock(&mutexTabela);
+
+    if (tabelaGuardada != NULL && --tabelaGuardada->usos == 0) free(tabelaGuardada);
+
+    tabelaGuardada = t;
+    pthread_mutex_unlock(&mutexTabela);
+
+    return t;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Solta a tabela de `obterTabelaAlfa()`; a última referência a libera.
+ */
+static void soltarTabelaAlfa(tpTabelaAlfa *tabela)
+{
+    pthread_mutex_lock(&mutexTabela);
+
+    if (--tabela->usos == 0) free(tabela);
+
+    pthread_mutex_unlock(&mutexTabela);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Retorna um instante em segundos, de um relógio monotônico.
+ */
+static double relogio(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Endereço da linha `i` de uma imagem de 8 bits.
+ */
+static tpPixel *linhaImagem(const tpImagem *img, size_t i)
+{
+    return img->linhas != NULL ? img->linhas[i] : img->pixels + i * img->passo;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Endereço da linha `i` de uma imagem de 16 bits.
+ */
+static tpPixel16 *linhaImagem16(const tpImagem *img, size_t i)
+{
+    return img->linhas16 != NULL ? img->linhas16[i] : img->pixels16 + i * img->passo;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Placa do matte de diferença sob a linha `i` do fundo, a partir de `colIni`.
+ *
+ * A placa de `tpOpcoesChave` tem a grade do foreground; sem ela, a placa é o
+ * próprio fundo.
+ */
+static const tpPixel *linhaPlaca(const tpComposicao *c, size_t i)
+{
+    if (c->placa != NULL) return linhaImagem(c->placa, i + c->desvioLin) + c->colIni + c->desvioCol;
+
+    return linhaImagem(c->back, i) + c->colIni;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Calcula a região do fundo coberta pelo foreground posicionado.
+ *
+ * O recorte (ou o foreground inteiro) é colocado com o canto em (`deslocX`,
+ * `deslocY`), limitado às bordas do foreground e cortado nas bordas do
+ * fundo. A parte de um recorte que começa antes do foreground (origem
+ * negativa) fica vazia, então o resto não se desloca. Sem sobreposição, a
+ * região fica vazia.
+ */
+static void posicionar(tpComposicao *c)
+{
+    const tpOpcoesChave *o = c->opcoes;
+    long long recorteX = o->recortar ? o->recorteX : 0, recorteY = o->recortar ? o->recorteY : 0;
+    long long x0 = recorteX > 0 ? recorteX : 0, y0 = recorteY > 0 ? recorteY : 0;
+    long long x1 = (long long)c->fore->nCol, y1 = (long long)c->fore->nLin;
+    long long destX = o->deslocX + (x0 - recorteX), destY = o->deslocY + (y0 - recorteY);
+    long long ini, fim;
+
+    if (o->recortar && o->recorteL >= 0 && recorteX + o->recorteL < x1) x1 = recorteX + o->recorteL;
+    if (o->recortar && o->recorteA >= 0 && recorteY + o->recorteA < y1) y1 = recorteY + o->recorteA;
+
+    c->linIni = c->linFim = c->colIni = c->colFim = 0;
+    c->desvioCol = x0 - destX;
+    c->desvioLin = y0 - destY;
+
+    if (x1 <= x0 || y1 <= y0) return;
+
+    ini = destX > 0 ? destX : 0;
+    fim = destX + (x1 - x0) < (long long)c->back->nCol ? destX + (x1 - x0) : (long long)c->back->nCol;
+
+    if (fim <= ini) return;
+
+    c->colIni = (size_t)ini;
+    c->colFim = (size_t)fim;
+
+    ini = destY > 0 ? destY : 0;
+    fim = destY + (y1 - y0) < (long long)c->back->nLin ? destY + (y1 - y0) : (long long)c->back->nLin;
+
+    if (fim <= ini){
+
+        c->colIni = c->colFim = 0;
+        return;
+    }
+
+    c->linIni = (size_t)ini;
+    c->linFim = (size_t)fim;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Laço de cada thread: retira bandas do contador até acabarem.
+ */
+static void *trabalharBandas(void *arg)
+{
+    tpComposicao *c = (tpComposicao *)arg;
+    size_t banda;
+
+    while ((banda = atomic_fetch_add(&c->proximaBanda, 1)) < c->nBandas) c->tarefa(c, banda);
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Executa `tarefa` para as bandas 0..nBandas-1 e espera todas terminarem.
+ *
+ * A thread que chama trabalha junto com `threads - 1` criadas para a
+ * passada. Se a criação falhar, a passada segue com as que já existem, no
+ * mínimo só a que chama.
+ */
+static void repartirBandas(tpComposicao *c, void (*tarefa)(tpComposicao *c, size_t banda), size_t nBandas)
+{
+    int nThreads = c->opcoes->threads > 1 ? c->opcoes->threads : 1;
+    pthread_t *threads = NULL;
+    int criadas = 0;
+
+    if ((size_t)nThreads > nBandas) nThreads = nBandas > 0 ? (int)nBandas : 1;
+
+    c->tarefa = tarefa;
+    c->nBandas = nBandas;
+    atomic_store(&c->proximaBanda, 0);
+
+    if (nThreads > 1) threads = (pthread_t *)malloc(sizeof(pthread_t) * (nThreads - 1));
+
+    while (threads != NULL && criadas < nThreads - 1 && pthread_create(&threads[criadas], NULL, trabalharBandas, c) == 0) criadas++;
+
+    trabalharBandas(c);
+
+    for (int t = 0; t < criadas; t++) pthread_join(threads[t], NULL);
+
+    free(threads);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Soma as contagens de uma banda aos totais da composição.
+ */
+static void somarContagem(tpComposicao *c, const size_t cont[3])
+{
+    pthread_mutex_lock(&c->mutex);
+    c->cont[0] += cont[0];
+    c->cont[1] += cont[1];
+    c->cont[2] += cont[2];
+    pthread_mutex_unlock(&c->mutex);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Copia as linhas [ini, fim) do fundo para a saída.
+ *
+ * Linhas consecutivas que estão contíguas nas duas imagens (o caso comum)
+ * são copiadas com um único `memcpy`. Linhas da saída que são as do próprio
+ * fundo (composição no lugar) não são copiadas.
+ */
+static void copiarFundo(const tpComposicao *c, size_t ini, size_t fim)
+{
+    size_t bytesLinha = (c->bits16 ? sizeof(tpPixel16) : sizeof(tpPixel)) * c->back->nCol;
+
+    while (ini < fim){
+
+        unsigned char *destino = c->bits16 ? (unsigned char *)linhaImagem16(c->saida, ini) : (unsigned char *)linhaImagem(c->saida, ini);
+        const unsigned char *origem = c->bits16 ? (unsigned char *)linhaImagem16(c->back, ini) : (unsigned char *)linhaImagem(c->back, ini);
+        size_t n = 1;
+
+        while (ini + n < fim &&
+               (c->bits16 ? (unsigned char *)linhaImagem16(c->saida, ini + n) : (unsigned char *)linhaImagem(c->saida, ini + n)) == destino + n * bytesLinha &&
+               (c->bits16 ? (unsigned char *)linhaImagem16(c->back, ini + n) : (unsigned char *)linhaImagem(c->back, ini + n)) == origem + n * bytesLinha) n++;
+
+        if (destino != origem) memcpy(destino, origem, bytesLinha * n);
+
+        ini += n;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Conta quantos pixels das linhas sobrepostas de uma banda seguem cada caminho.
+ *
+ * Refaz o teste do kernel (ou a consulta à tabela suave) sem gravar nada:
+ * `cont[0]` recebe o fundo, `cont[1]` o foreground e `cont[2]` a mistura.
+ * Fica fora da composição para não pesar nos kernels vetorizados, e roda
+ * antes dela, então a placa que é o próprio fundo ainda não foi sobrescrita
+ * numa composição no lugar.
+ */
+static void contarBanda(tpComposicao *c, size_t banda)
+{
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < c->back->nLin ? ini + LINHAS_BANDA : c->back->nLin;
+    size_t nCol = c->colFim - c->colIni;
+    size_t cont[3] = {0, 0, 0};
+    const int desloc = 8 - LUT_BITS;
+
+    for (size_t i = ini > c->linIni ? ini : c->linIni; i < fim && i < c->linFim; i++){
+
+        if (c->bits16){
+
+            const tpPixel16 *fore = linhaImagem16(c->fore, i + c->desvioLin) + c->colIni + c->desvioCol;
+
+            for (size_t j = 0; j < nCol; j++){
+
+                long long dr = fore[j].R - c->chave16.R, dg = fore[j].G - c->chave16.G, db = fore[j].B - c->chave16.B;
+                long long distancia = dr * dr + dg * dg + db * db;
+
+                cont[distancia < c->chave16.tolerancia ? 0 : distancia > c->chave16.tolerancia ? 1 : 2]++;
+            }
+
+            continue;
+        }
+
+        const tpPixel *fore = linhaImagem(c->fore, i + c->desvioLin) + c->colIni + c->desvioCol;
+
+        if (c->alfa != NULL){
+
+            for (size_t j = 0; j < nCol; j++){
+
+                int alfa = c->alfa[(((fore[j].R >> desloc) << LUT_BITS | (fore[j].G >> desloc)) << LUT_BITS) | (fore[j].B >> desloc)];
+
+                cont[alfa == 0 ? 0 : alfa == 255 ? 1 : 2]++;
+            }
+        }
+
+        else if (c->diferenca){
+
+            const tpPixel *placa = linhaPlaca(c, i);
+
+            for (size_t j = 0; j < nCol; j++){
+
+                int distancia = distanciaPixels(&fore[j], &placa[j], c->chave.espaco);
+
+                cont[distancia < c->chave.tolerancia ? 0 : distancia > c->chave.tolerancia ? 1 : 2]++;
+            }
+        }
+
+        else{
+
+            for (size_t j = 0; j < nCol; j++){
+
+                int distancia = distanciaChave(&fore[j], &c->chave);
+
+                cont[distancia < c->chave.tolerancia ? 0 : distancia > c->chave.tolerancia ? 1 : 2]++;
+            }
+        }
+    } // END_I
+
+    somarContagem(c, cont);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Compõe as linhas de uma banda de `LINHAS_BANDA` linhas do fundo.
+ *
+ * As linhas da banda fora da sobreposição são copiadas do fundo em bloco;
+ * nas demais, só as colunas [colIni, colFim) passam pelo kernel (da chave,
+ * da diferença ou da tabela suave) e o resto da linha recebe o fundo.
+ */
+static void comporBanda(tpComposicao *c, size_t banda)
+{
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < c->back->nLin ? ini + LINHAS_BANDA : c->back->nLin;
+    size_t sobIni = ini > c->linIni ? ini : c->linIni;
+    size_t sobFim = fim < c->linFim ? fim : c->linFim;
+    size_t colIni = c->colIni, colFim = c->colFim, nColB = c->back->nCol;
+
+    if (sobFim <= sobIni) sobIni = sobFim = fim;
+
+    copiarFundo(c, ini, sobIni);
+    copiarFundo(c, sobFim, fim);
+
+    for (size_t i = sobIni; i < sobFim; i++){
+
+        tpPixel *saida = linhaImagem(c->saida, i);
+        const tpPixel *back = linhaImagem(c->back, i);
+        const tpPixel *fore = linhaImagem(c->fore, i + c->desvioLin) + colIni + c->desvioCol;
+
+        if (saida != back){
+
+            memcpy(saida, back, sizeof(tpPixel) * colIni);
+            memcpy(saida + colFim, back + colFim, sizeof(tpPixel) * (nColB - colFim));
+        }
+
+        if (c->alfa != NULL) comporLinhaSuave(saida + colIni, back + colIni, fore, colFim - colIni, c->alfa, c->chave.despill);
+        else if (c->diferenca) c->kernels->diferenca(saida + colIni, back + colIni, fore, linhaPlaca(c, i), colFim - colIni, &c->chave);
+        else c->kernels->linha(saida + colIni, back + colIni, fore, colFim - colIni, &c->chave);
+    } // END_I
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão de `comporBanda()` para imagens de 16 bits.
+ */
+static void comporBanda16(tpComposicao *c, size_t banda)
+{
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < c->back->nLin ? ini + LINHAS_BANDA : c->back->nLin;
+    size_t sobIni = ini > c->linIni ? ini : c->linIni;
+    size_t sobFim = fim < c->linFim ? fim : c->linFim;
+    size_t colIni = c->colIni, colFim = c->colFim, nColB = c->back->nCol;
+
+    if (sobFim <= sobIni) sobIni = sobFim = fim;
+
+    copiarFundo(c, ini, sobIni);
+    copiarFundo(c, sobFim, fim);
+
+    for (size_t i = sobIni; i < sobFim; i++){
+
+        tpPixel16 *saida = linhaImagem16(c->saida, i);
+        const tpPixel16 *back = linhaImagem16(c->back, i);
+        const tpPixel16 *fore = linhaImagem16(c->fore, i + c->desvioLin) + colIni + c->desvioCol;
+
+        if (saida != back){
+
+            memcpy(saida, back, sizeof(tpPixel16) * colIni);
+            memcpy(saida + colFim, back + colFim, sizeof(tpPixel16) * (nColB - colFim));
+        }
+
+        c->kernels->linha16(saida + colIni, back + colIni, fore, colFim - colIni, &c->chave16);
+    } // END_I
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Aloca uma imagem planar com planos e linhas alinhados em `ALINHAMENTO`.
+ *
+ * A memória é zerada, então o preenchimento ao fim de cada linha pode ser lido
+ * pelos kernels vetoriais sem tratamento de sobra. Devolve 0 sem memória.
+ */
+static int alocarPlanar(tpImagemPlanar *img, size_t nLin, size_t nCol)
+{
+    size_t plano;
+
+    img->nLin = nLin;
+    img->nCol = nCol;
+    img->passo = (nCol + ALINHAMENTO - 1) / ALINHAMENTO * ALINHAMENTO;
+    plano = img->passo * (nLin > 0 ? nLin : 1);
+
+    img->bloco = (unsigned char *)calloc(3 * plano + ALINHAMENTO, 1);
+
+    if (img->bloco == NULL) return 0;
+
+    img->R = img->bloco + (ALINHAMENTO - (size_t)img->bloco % ALINHAMENTO);
+    img->G = img->R + plano;
+    img->B = img->G + plano;
+
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Converte as linhas de uma banda do fundo e do foreground para os planos.
+ *
+ * `foreP` tem a geometria do fundo: só a parte sobreposta do foreground é
+ * convertida, já na posição em que cai no fundo.
+ */
+static void converterBandaPlanar(tpComposicao *c, size_t banda)
+{
+    size_t fim = (banda + 1) * LINHAS_BANDA < c->back->nLin ? (banda + 1) * LINHAS_BANDA : c->back->nLin;
+    const tpImagemPlanar *backP = &c->backP, *foreP = &c->foreP;
+
+    for (size_t i = banda * LINHAS_BANDA; i < fim; i++){
+
+        size_t lb = i * backP->passo, lf = i * foreP->passo + c->colIni;
+
+        c->kernels->paraPlanar(linhaImagem(c->back, i), backP->R + lb, backP->G + lb, backP->B + lb, c->back->nCol);
+
+        if (i >= c->linIni && i < c->linFim)
+            c->kernels->paraPlanar(linhaImagem(c->fore, i + c->desvioLin) + c->colIni + c->desvioCol,
+                                   foreP->R + lf, foreP->G + lf, foreP->B + lf, c->colFim - c->colIni);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Compõe as linhas de uma banda sobre as imagens planares.
+ *
+ * Como em `comporBanda()`, as linhas só de fundo são copiadas em bloco; como
+ * `backP` e `saidaP` têm o mesmo passo, cada plano sai numa única cópia.
+ */
+static void comporBandaPlanar(tpComposicao *c, size_t banda)
+{
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < c->back->nLin ? ini + LINHAS_BANDA : c->back->nLin;
+    size_t sobIni = ini > c->linIni ? ini : c->linIni;
+    size_t sobFim = fim < c->linFim ? fim : c->linFim;
+    size_t colIni = c->colIni, colFim = c->colFim, nColB = c->back->nCol;
+    const tpImagemPlanar *backP = &c->backP, *saidaP = &c->saidaP;
+
+    if (sobFim <= sobIni) sobIni = sobFim = fim;
+
+    memcpy(saidaP->R + ini * saidaP->passo, backP->R + ini * backP->passo, backP->passo * (sobIni - ini));
+    memcpy(saidaP->G + ini * saidaP->passo, backP->G + ini * backP->passo, backP->passo * (sobIni - ini));
+    memcpy(saidaP->B + ini * saidaP->passo, backP->B + ini * backP->passo, backP->passo * (sobIni - ini));
+    memcpy(saidaP->R + sobFim * saidaP->passo, backP->R + sobFim * backP->passo, backP->passo * (fim - sobFim));
+    memcpy(saidaP->G + sobFim * saidaP->passo, backP->G + sobFim * backP->passo, backP->passo * (fim - sobFim));
+    memcpy(saidaP->B + sobFim * saidaP->passo, backP->B + sobFim * backP->passo, backP->passo * (fim - sobFim));
+
+    for (size_t i = sobIni; i < sobFim; i++){
+
+        size_t lb = i * backP->passo, ls = i * saidaP->passo;
+
+        c->kernels->planar(saidaP, backP, &c->foreP, i, colIni, colFim, &c->chave);
+
+        memcpy(saidaP->R + ls, backP->R + lb, colIni);
+        memcpy(saidaP->G + ls, backP->G + lb, colIni);
+        memcpy(saidaP->B + ls, backP->B + lb, colIni);
+        memcpy(saidaP->R + ls + colFim, backP->R + lb + colFim, nColB - colFim);
+        memcpy(saidaP->G + ls + colFim, backP->G + lb + colFim, nColB - colFim);
+        memcpy(saidaP->B + ls + colFim, backP->B + lb + colFim, nColB - colFim);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Converte as linhas de uma banda de `saidaP` de volta para a saída.
+ */
+static void converterBandaSaida(tpComposicao *c, size_t banda)
+{
+    size_t fim = (banda + 1) * LINHAS_BANDA < c->back->nLin ? (banda + 1) * LINHAS_BANDA : c->back->nLin;
+    const tpImagemPlanar *saidaP = &c->saidaP;
+
+    for (size_t i = banda * LINHAS_BANDA; i < fim; i++){
+
+        size_t linha = i * saidaP->passo;
+
+        c->kernels->dePlanar(linhaImagem(c->saida, i), saidaP->R + linha, saidaP->G + linha, saidaP->B + linha, c->back->nCol);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Composição sobre planos: converte, compõe e converte de volta.
+ *
+ * Os tempos da conversão (ida e volta) e da composição vão para
+ * `relatorio`, para comparar o ganho dos planos com o custo de chegar a eles.
+ */
+static void comporPlanar(tpComposicao *c, size_t nBandas, tpRelatorio *relatorio)
+{
+    size_t nLin = c->back->nLin, nCol = c->back->nCol;
+    double inicio, conversao, composicao;
+
+    if (!alocarPlanar(&c->backP, nLin, nCol) || !alocarPlanar(&c->foreP, nLin, nCol) || !alocarPlanar(&c->saidaP, nLin, nCol)){
+
+        c->erro = 1;
+        return;
+    }
+
+    inicio = relogio();
+    repartirBandas(c, converterBandaPlanar, nBandas);
+    conversao = relogio() - inicio;
+
+    inicio = relogio();
+    repartirBandas(c, comporBandaPlanar, nBandas);
+    composicao = relogio() - inicio;
+
+    inicio = relogio();
+    repartirBandas(c, converterBandaSaida, nBandas);
+    conversao += relogio() - inicio;
+
+    if (relatorio != NULL){
+
+        relatorio->tempoConversao = conversao;
+        relatorio->tempoComposicao = composicao;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Preenche as linhas do matte que caem em uma banda do fundo.
+ *
+ * Cada pixel da região sobreposta recebe a opacidade do foreground: 0 (fundo),
+ * 255 (foreground) ou 128 na borda exata da tolerância. Com a chave suave a
+ * opacidade vem da tabela.
+ */
+static void gerarMatteBanda(tpComposicao *c, size_t banda)
+{
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < c->back->nLin ? ini + LINHAS_BANDA : c->back->nLin;
+    size_t nCol = c->colFim - c->colIni;
+    const int desloc = 8 - LUT_BITS;
+
+    for (size_t i = ini > c->linIni ? ini : c->linIni; i < fim && i < c->linFim; i++){
+
+        const tpPixel *fore = linhaImagem(c->fore, i + c->desvioLin) + c->colIni + c->desvioCol;
+        unsigned char *m = c->matte + (i - c->linIni) * nCol;
+
+        if (c->alfa != NULL){
+
+            for (size_t j = 0; j < nCol; j++)
+                m[j] = c->alfa[(((fore[j].R >> desloc) << LUT_BITS | (fore[j].G >> desloc)) << LUT_BITS) | (fore[j].B >> desloc)];
+        }
+
+        else{
+
+            for (size_t j = 0; j < nCol; j++){
+
+                int distancia = distanciaChave(&fore[j], &c->chave);
+
+                m[j] = distancia < c->chave.tolerancia ? 0 : distancia > c->chave.tolerancia ? 255 : 128;
+            }
+        }
+    } // END_I
+}
+
+//-----------------------------------------------------------------------------
+
+
+/**
+ * @brief Copia `linha` para `pad` com `raio` bytes replicados em cada ponta.
+ */
+static void estenderLinha(unsigned char *pad, const unsigned char *linha, size_t nCol, int raio)
+{
+    memset(pad, linha[0], raio);
+    memcpy(pad + raio, linha, nCol);
+    memset(pad + raio + nCol, linha[nCol - 1], raio);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief `dest[j] = min(dest[j], orig[j])`, 16 bytes por vez quando há SSE2.
+ */
+static void minimoLinha(unsigned char *dest, const unsigned char *orig, size_t n)
+{
+    size_t j = 0;
+
+#ifdef __SSE2__
+    for (; j + 16 <= n; j += 16)
+        _mm_storeu_si128((__m128i *)(dest + j), _mm_min_epu8(_mm_loadu_si128((const __m128i *)(dest + j)), _mm_loadu_si128((const __m128i *)(orig + j))));
+#endif
+
+    for (; j < n; j++) if (orig[j] < dest[j]) dest[j] = orig[j];
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief `dest[j] = max(dest[j], orig[j])`, 16 bytes por vez quando há SSE2.
+ */
+static void maximoLinha(unsigned char *dest, const unsigned char *orig, size_t n)
+{
+    size_t j = 0;
+
+#ifdef __SSE2__
+    for (; j + 16 <= n; j += 16)
+        _mm_storeu_si128((__m128i *)(dest + j), _mm_max_epu8(_mm_loadu_si128((const __m128i *)(dest + j)), _mm_loadu_si128((const __m128i *)(orig + j))));
+#endif
+
+    for (; j < n; j++) if (orig[j] > dest[j]) dest[j] = orig[j];
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Desliza as somas por coluna da caixa: soma a linha que entra e tira a que sai.
+ *
+ * Com raio até `CHROMA_RAIO_MAX` a soma de uma janela cabe em 16 bits, então
+ * são 8 colunas por instrução.
+ */
+static void deslizarSomas(unsigned short *somas, const unsigned char *entra, const unsigned char *sai, size_t n)
+{
+    size_t j = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; j + 16 <= n; j += 16){
+
+        __m128i e = _mm_loadu_si128((const __m128i *)(entra + j));
+        __m128i s = _mm_loadu_si128((const __m128i *)(sai + j));
+        __m128i lo = _mm_loadu_si128((const __m128i *)(somas + j));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(somas + j + 8));
+
+        lo = _mm_sub_epi16(_mm_add_epi16(lo, _mm_unpacklo_epi8(e, zero)), _mm_unpacklo_epi8(s, zero));
+        hi = _mm_sub_epi16(_mm_add_epi16(hi, _mm_unpackhi_epi8(e, zero)), _mm_unpackhi_epi8(s, zero));
+
+        _mm_storeu_si128((__m128i *)(somas + j), lo);
+        _mm_storeu_si128((__m128i *)(somas + j + 8), hi);
+    }
+#endif
+
+    for (; j < n; j++) somas[j] += entra[j] - sai[j];
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Passada horizontal de um filtro do matte sobre uma banda de linhas.
+ *
+ * Mínimo e máximo comparam a linha estendida deslocada de 0 a 2*raio com a
+ * saída, 16 bytes por instrução. A média da caixa usa soma deslizante, O(1) por pixel, e divide
+ * por tabela.
+ */
+static void filtrarHorizontalBanda(tpComposicao *c, size_t banda)
+{
+    const tpFiltro *f = c->filtro;
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < f->nLin ? ini + LINHAS_BANDA : f->nLin;
+    size_t largura = 2 * (size_t)f->raio + 1;
+    unsigned char *pad = (unsigned char *)malloc(f->nCol + 2 * f->raio + 1);
+
+    if (pad == NULL){
+
+        pthread_mutex_lock(&c->mutex);
+        c->erro = 1;
+        pthread_mutex_unlock(&c->mutex);
+        return;
+    }
+
+    for (size_t i = ini; i < fim; i++){
+
+        const unsigned char *orig = f->origem + i * f->nCol;
+        unsigned char *dest = f->destino + i * f->nCol;
+
+        estenderLinha(pad, orig, f->nCol, f->raio);
+        pad[f->nCol + 2 * f->raio] = 0; /* Lido só pela última atualização da soma, que é descartada. */
+
+        if (f->tipo == FILTRO_CAIXA){
+
+            unsigned int soma = 0;
+
+            for (size_t k = 0; k < largura; k++) soma += pad[k];
+
+            for (size_t j = 0; j < f->nCol; j++){
+
+                dest[j] = f->divisao[soma];
+                soma += pad[j + largura] - pad[j];
+            }
+        }
+
+        else{
+
+            memcpy(dest, pad, f->nCol);
+
+            for (size_t k = 1; k < largura; k++){
+
+                if (f->tipo == FILTRO_EROSAO) minimoLinha(dest, pad + k, f->nCol);
+                else maximoLinha(dest, pad + k, f->nCol);
+            }
+        }
+    } // END_I
+
+    free(pad);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Passada vertical de um filtro do matte sobre uma banda de linhas.
+ *
+ * As colunas são processadas em blocos de `COLUNAS_BLOCO_MATTE`, então as
+ * 2*raio+1 linhas da janela de cada bloco cabem na cache; dentro do bloco
+ * mínimo, máximo e somas andam por bytes contíguos, 16 colunas por vez. Na
+ * caixa, as somas por coluna deslizam uma linha por vez.
+ */
+static void filtrarVerticalBanda(tpComposicao *c, size_t banda)
+{
+    const tpFiltro *f = c->filtro;
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < f->nLin ? ini + LINHAS_BANDA : f->nLin;
+    long long ultima = (long long)f->nLin - 1;
+    unsigned short somas[COLUNAS_BLOCO_MATTE];
+
+    for (size_t c0 = 0; c0 < f->nCol; c0 += COLUNAS_BLOCO_MATTE){
+
+        size_t n = f->nCol - c0 < COLUNAS_BLOCO_MATTE ? f->nCol - c0 : COLUNAS_BLOCO_MATTE;
+
+        if (f->tipo == FILTRO_CAIXA){
+
+            memset(somas, 0, sizeof(somas));
+
+            for (long long k = (long long)ini - f->raio; k <= (long long)ini + f->raio; k++){
+
+                const unsigned char *p = f->origem + (k < 0 ? 0 : k > ultima ? ultima : k) * f->nCol + c0;
+
+                for (size_t j = 0; j < n; j++) somas[j] += p[j];
+            }
+
+            for (size_t i = ini; i < fim; i++){
+
+                unsigned char *dest = f->destino + i * f->nCol + c0;
+                long long entra = (long long)i + f->raio + 1, sai = (long long)i - f->raio;
+                const unsigned char *pe = f->origem + (entra > ultima ? ultima : entra) * f->nCol + c0;
+                const unsigned char *ps = f->origem + (sai < 0 ? 0 : sai) * f->nCol + c0;
+
+                for (size_t j = 0; j < n; j++) dest[j] = f->divisao[somas[j]];
+
+                deslizarSomas(somas, pe, ps, n);
+            }
+        }
+
+        else{
+
+            for (size_t i = ini; i < fim; i++){
+
+                unsigned char *dest = f->destino + i * f->nCol + c0;
+                long long k0 = (long long)i - f->raio;
+
+                memcpy(dest, f->origem + (k0 < 0 ? 0 : k0) * f->nCol + c0, n);
+
+                for (long long k = k0 + 1; k <= (long long)i + f->raio; k++){
+
+                    const unsigned char *p = f->origem + (k < 0 ? 0 : k > ultima ? ultima : k) * f->nCol + c0;
+
+                    if (f->tipo == FILTRO_EROSAO) minimoLinha(dest, p, n);
+                    else maximoLinha(dest, p, n);
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Aplica um filtro separável ao matte: horizontal em `matteAux`, vertical de volta.
+ */
+static void filtrarMatte(tpComposicao *c, int tipo, int raio)
+{
+    size_t nLin = c->linFim - c->linIni, nCol = c->colFim - c->colIni;
+    size_t nBandas = (nLin + LINHAS_BANDA - 1) / LINHAS_BANDA;
+    unsigned char *divisao = NULL;
+    tpFiltro f;
+
+    if (raio <= 0 || nLin == 0 || nCol == 0 || c->erro) return;
+
+    if (tipo == FILTRO_CAIXA){
+
+        unsigned int largura = 2 * raio + 1;
+
+        divisao = (unsigned char *)malloc(255 * largura + 1);
+
+        if (divisao == NULL){
+
+            c->erro = 1;
+            return;
+        }
+
+        for (unsigned int s = 0; s <= 255 * largura; s++) divisao[s] = (s + largura / 2) / largura;
+    }
+
+    f.tipo = tipo;
+    f.raio = raio;
+    f.nLin = nLin;
+    f.nCol = nCol;
+    f.divisao = divisao;
+    c->filtro = &f;
+
+    f.origem = c->matte;
+    f.destino = c->matteAux;
+    repartirBandas(c, filtrarHorizontalBanda, nBandas);
+
+    f.origem = c->matteAux;
+    f.destino = c->matte;
+    repartirBandas(c, filtrarVerticalBanda, nBandas);
+
+    free(divisao);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Compõe uma banda do fundo usando o matte já filtrado.
+ *
+ * Fora da sobreposição copia o fundo, como `comporBanda()`. Dentro dela,
+ * opacidade 0 dá o fundo, 255 o foreground e as intermediárias a mistura
+ * linear; o foreground passa por `removerVazamento()` com despill. Sem a
+ * chave suave, 128 (a borda exata) dá a média truncada, como os kernels,
+ * então regiões que os filtros não tocam saem iguais à composição sem eles.
+ * Com `contar`, conta os três casos a partir do matte final.
+ */
+static void misturarBanda(tpComposicao *c, size_t banda)
+{
+    size_t ini = banda * LINHAS_BANDA;
+    size_t fim = ini + LINHAS_BANDA < c->back->nLin ? ini + LINHAS_BANDA : c->back->nLin;
+    size_t sobIni = ini > c->linIni ? ini : c->linIni;
+    size_t sobFim = fim < c->linFim ? fim : c->linFim;
+    size_t colIni = c->colIni, colFim = c->colFim, nColB = c->back->nCol;
+    size_t nCol = colFim - colIni;
+    size_t cont[3] = {0, 0, 0};
+
+    if (sobFim <= sobIni) sobIni = sobFim = fim;
+
+    copiarFundo(c, ini, sobIni);
+    copiarFundo(c, sobFim, fim);
+
+    for (size_t i = sobIni; i < sobFim; i++){
+
+        tpPixel *linhaSaida = linhaImagem(c->saida, i);
+        const tpPixel *linhaBack = linhaImagem(c->back, i);
+        tpPixel *saida = linhaSaida + colIni;
+        const tpPixel *back = linhaBack + colIni;
+        const tpPixel *fore = linhaImagem(c->fore, i + c->desvioLin) + colIni + c->desvioCol;
+        const unsigned char *m = c->matte + (i - c->linIni) * nCol;
+
+        if (linhaSaida != linhaBack) memcpy(linhaSaida, linhaBack, sizeof(tpPixel) * colIni);
+
+        for (size_t j = 0; j < nCol; j++){
+
+            int alfa = m[j];
+            tpPixel atual;
+
+            if (alfa == 0){
+
+                saida[j] = back[j];
+                cont[0]++;
+                continue;
+            }
+
+            atual = removerVazamento(fore[j], c->chave.despill);
+
+            if (alfa == 255){
+
+                saida[j] = atual;
+                cont[1]++;
+                continue;
+            }
+
+            cont[2]++;
+
+            /* O meio do matte rígido é a média truncada dos kernels sem filtros. */
+            if (alfa == 128 && c->alfa == NULL){
+
+                saida[j].R = (back[j].R + atual.R) / 2;
+                saida[j].G = (back[j].G + atual.G) / 2;
+                saida[j].B = (back[j].B + atual.B) / 2;
+            }
+
+            else{
+
+                saida[j].R = (atual.R * alfa + back[j].R * (255 - alfa) + 127) / 255;
+                saida[j].G = (atual.G * alfa + back[j].G * (255 - alfa) + 127) / 255;
+                saida[j].B = (atual.B * alfa + back[j].B * (255 - alfa) + 127) / 255;
+            }
+        }
+
+        if (linhaSaida != linhaBack) memcpy(linhaSaida + colFim, linhaBack + colFim, sizeof(tpPixel) * (nColB - colFim));
+    } // END_I
+
+    if (c->contar) somarContagem(c, cont);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Composição com matte explícito: gera, filtra e mistura.
+ *
+ * Substitui `comporBanda()` quando algum filtro do matte é pedido. Os filtros
+ * rodam nesta ordem: erosão, dilatação (juntas, uma abertura que remove
+ * pontos isolados), caixa e, por fim, três caixas seguidas, que aproximam
+ * uma gaussiana.
+ */
+static void comporComMatte(tpComposicao *c, size_t nBandas, tpRelatorio *relatorio)
+{
+    const tpOpcoesChave *o = c->opcoes;
+    size_t tamanho = (c->linFim - c->linIni) * (c->colFim - c->colIni);
+    double inicio;
+
+    c->matte = (unsigned char *)malloc(tamanho > 0 ? tamanho : 1);
+    c->matteAux = (unsigned char *)malloc(tamanho > 0 ? tamanho : 1);
+
+    if (c->matte == NULL || c->matteAux == NULL){
+
+        c->erro = 1;
+        return;
+    }
+
+    repartirBandas(c, gerarMatteBanda, nBandas);
+
+    inicio = relogio();
+    filtrarMatte(c, FILTRO_EROSAO, o->raioErosao);
+    filtrarMatte(c, FILTRO_DILATACAO, o->raioDilatacao);
+    filtrarMatte(c, FILTRO_CAIXA, o->raioCaixa);
+
+    for (int k = 0; k < 3; k++) filtrarMatte(c, FILTRO_CAIXA, o->raioGauss);
+
+    if (relatorio != NULL) relatorio->tempoFiltros = relogio() - inicio;
+
+    if (!c->erro) repartirBandas(c, misturarBanda, nBandas);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Confere ponteiros, opções e combinações de `compor()`.
+ *
+ * @return `CHROMA_OK`, `CHROMA_ERRO_PARAMETRO` ou `CHROMA_ERRO_DIMENSAO`.
+ */
+static int validarOpcoes(const tpImagem *fore, const tpImagem *back, const tpImagem *saida, const tpOpcoesChave *opcoes)
+{
+    const tpImagem *placa = opcoes->placa;
+    const tpImagem *imagens[3] = {fore, back, saida};
+    int bits16, filtros, diferenca;
+
+    if (fore == NULL || back == NULL || saida == NULL) return CHROMA_ERRO_PARAMETRO;
+
+    bits16 = fore->pixels16 != NULL || fore->linhas16 != NULL;
+    filtros = opcoes->raioErosao || opcoes->raioDilatacao || opcoes->raioCaixa || opcoes->raioGauss;
+    diferenca = placa != NULL || opcoes->diferenca;
+
+    for (int k = 0; k < 3; k++){
+
+        const tpImagem *img = imagens[k];
+
+        if (bits16 ? img->pixels16 == NULL && img->linhas16 == NULL : img->pixels == NULL && img->linhas == NULL)
+            return CHROMA_ERRO_PARAMETRO;
+    }
+
+    if (placa != NULL && placa->pixels == NULL && placa->linhas == NULL) return CHROMA_ERRO_PARAMETRO;
+
+    if (opcoes->simd < CHROMA_SIMD_AUTO || opcoes->simd > CHROMA_SIMD_AVX2 ||
+        (opcoes->espaco != CHROMA_ESPACO_RGB && opcoes->espaco != CHROMA_ESPACO_CBCR) || opcoes->threads < 0)
+        return CHROMA_ERRO_PARAMETRO;
+
+    if (opcoes->raioErosao < 0 || opcoes->raioErosao > CHROMA_RAIO_MAX || opcoes->raioDilatacao < 0 || opcoes->raioDilatacao > CHROMA_RAIO_MAX ||
+        opcoes->raioCaixa < 0 || opcoes->raioCaixa > CHROMA_RAIO_MAX || opcoes->raioGauss < 0 || opcoes->raioGauss > CHROMA_RAIO_MAX)
+        return CHROMA_ERRO_PARAMETRO;
+
+    if (bits16 && (opcoes->suave || opcoes->planar || filtros || diferenca || opcoes->despill || opcoes->espaco != CHROMA_ESPACO_RGB))
+        return CHROMA_ERRO_PARAMETRO;
+
+    if (opcoes->planar && (opcoes->suave || filtros || diferenca || opcoes->despill || opcoes->espaco != CHROMA_ESPACO_RGB))
+        return CHROMA_ERRO_PARAMETRO;
+
+    if ((opcoes->suave && (diferenca || opcoes->espaco != CHROMA_ESPACO_RGB)) || (diferenca && (filtros || opcoes->despill)))
+        return CHROMA_ERRO_PARAMETRO;
+
+    for (int k = 0; k < 3; k++){
+
+        const tpImagem *img = imagens[k];
+
+        if ((bits16 ? img->linhas16 == NULL : img->linhas == NULL) && img->passo < img->nCol) return CHROMA_ERRO_DIMENSAO;
+    }
+
+    if (saida->nLin != back->nLin || saida->nCol != back->nCol) return CHROMA_ERRO_DIMENSAO;
+
+    if (placa != NULL && (placa->nLin != fore->nLin || placa->nCol != fore->nCol || (placa->linhas == NULL && placa->passo < placa->nCol)))
+        return CHROMA_ERRO_DIMENSAO;
+
+    return CHROMA_OK;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Aplica o Chroma Key sobre imagens na memória do chamador.
+ *
+ * Reentrante: tudo o que a composição usa fica em um `tpComposicao` local, e
+ * o que é global (kernels e tabela suave guardada) é montado sob
+ * `pthread_once()` ou mutex. Os erros são devolvidos como código em vez de
+ * encerrar o programa; a tolerância, como na linha de comando, é limitada ao
+ * intervalo 0..441 (0..113511 em 16 bits).
+ *
+ * Com `contar`, os pixels são contados antes da composição, numa passada
+ * própria, para que o tempo da contagem fique separado e para que uma
+ * composição no lugar não mude a placa que é o próprio fundo.
+ */
+int compor(const tpImagem *fore, const tpImagem *back, tpPixel chave, int tolerancia, tpImagem *saida, const tpOpcoesChave *opcoes)
+{
+    tpOpcoesChave padrao;
+    tpRelatorio *relatorio;
+    tpTabelaAlfa *tabela = NULL;
+    tpComposicao c;
+    size_t nBandas;
+    int filtros, retorno;
+
+    if (opcoes == NULL){
+
+        memset(&padrao, 0, sizeof(padrao));
+        opcoes = &padrao;
+    }
+
+    retorno = validarOpcoes(fore, back, saida, opcoes);
+
+    if (retorno != CHROMA_OK) return retorno;
+
+    pthread_once(&kernelsIniciados, iniciarKernels);
+
+    memset(&c, 0, sizeof(c));
+    c.fore = fore;
+    c.back = back;
+    c.saida = saida;
+    c.placa = opcoes->placa;
+    c.opcoes = opcoes;
+    c.kernels = &tabelaKernels[opcoes->simd];
+    c.bits16 = fore->pixels16 != NULL || fore->linhas16 != NULL;
+    c.diferenca = opcoes->placa != NULL || opcoes->diferenca;
+
+    relatorio = opcoes->relatorio;
+    c.contar = opcoes->contar && relatorio != NULL;
+    filtros = opcoes->raioErosao || opcoes->raioDilatacao || opcoes->raioCaixa || opcoes->raioGauss;
+
+    if (tolerancia < 0) tolerancia = 0;
+    else if (tolerancia > (c.bits16 ? TOL_MAXIMA16 : TOL_MAXIMA)) tolerancia = c.bits16 ? TOL_MAXIMA16 : TOL_MAXIMA;
+
+    c.chave.R = chave.R;
+    c.chave.G = chave.G;
+    c.chave.B = chave.B;
+    c.chave.Cb = calcularCb(chave.R, chave.G, chave.B);
+    c.chave.Cr = calcularCr(chave.R, chave.G, chave.B);
+    c.chave.espaco = opcoes->espaco;
+    c.chave.despill = opcoes->despill && !c.diferenca ? canalDominante(chave.R, chave.G, chave.B) : -1;
+    c.chave.tolerancia = tolerancia * tolerancia;
+
+    c.chave16.R = opcoes->chave16.R;
+    c.chave16.G = opcoes->chave16.G;
+    c.chave16.B = opcoes->chave16.B;
+    c.chave16.tolerancia = (long long)tolerancia * tolerancia;
+
+    if (opcoes->suave){
+
+        int tolExterna = opcoes->tolExterna < tolerancia ? tolerancia : opcoes->tolExterna > TOL_MAXIMA ? TOL_MAXIMA : opcoes->tolExterna;
+
+        tabela = obterTabelaAlfa(chave, tolerancia, tolExterna);
+
+        if (tabela == NULL) return CHROMA_ERRO_MEMORIA;
+
+        c.alfa = tabela->alfa;
+    }
+
+    if (relatorio != NULL){
+
+        memset(relatorio, 0, sizeof(tpRelatorio));
+        relatorio->kernel = c.bits16 ? c.kernels->nome16 : c.alfa != NULL ? "suave" : c.kernels->nome;
+    }
+
+    posicionar(&c);
+    pthread_mutex_init(&c.mutex, NULL);
+    nBandas = (back->nLin + LINHAS_BANDA - 1) / LINHAS_BANDA;
+
+    if (c.contar && !filtros){
+
+        double inicio = relogio();
+
+        repartirBandas(&c, contarBanda, nBandas);
+        relatorio->tempoContagem = relogio() - inicio;
+    }
+
+    if (c.bits16) repartirBandas(&c, comporBanda16, nBandas);
+    else if (opcoes->planar) comporPlanar(&c, nBandas, relatorio);
+    else if (filtros) comporComMatte(&c, nBandas, relatorio);
+    else repartirBandas(&c, comporBanda, nBandas);
+
+    if (c.contar){
+
+        relatorio->fundo = c.cont[0];
+        relatorio->frente = c.cont[1];
+        relatorio->borda = c.cont[2];
+    }
+
+    free(c.backP.bloco);
+    free(c.foreP.bloco);
+    free(c.saidaP.bloco);
+    free(c.matte);
+    free(c.matteAux);
+    pthread_mutex_destroy(&c.mutex);
+
+    if (tabela != NULL) soltarTabelaAlfa(tabela);
+
+    return c.erro ? CHROMA_ERRO_MEMORIA : CHROMA_OK;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file chromakey.h
+ * @brief Interface de biblioteca do Chroma Key, sobre memória do chamador.
+ *
+ * Permite compor imagens já carregadas sem passar por arquivos: o chamador
+ * descreve cada imagem com um `tpImagem` (ponteiro ou tabela de linhas,
+ * dimensões e passo) e chama `compor()`, com as opções em `tpOpcoesChave`.
+ * Todos os modos de composição ficam aqui: chave rígida ou suave, espaço de
+ * cor, despill, matte de diferença, filtros do matte, imagens de 16 bits,
+ * planos separados, posição e recorte do foreground e várias threads. A
+ * função não encerra o programa e pode ser chamada de várias threads ao mesmo
+ * tempo sobre imagens diferentes.
+ *
+ * Para usar como biblioteca, compile e ligue só `chromakey.c` (com
+ * `-lpthread -lm`), que exporta apenas `compor()`. O programa de linha de
+ * comando (`chromakeyFinal.c`) lê e grava os arquivos e compõe por ela.
+ *
+ * @author Társis Barreto
+ * @author Isaque Passos
+ */
+
+#ifndef CHROMAKEY_H
+#define CHROMAKEY_H
+
+#include <stddef.h>
+
+#define CHROMA_OK 0
+#define CHROMA_ERRO_PARAMETRO -1 /**< Ponteiro nulo, opção inválida ou combinação de opções sem suporte. */
+#define CHROMA_ERRO_DIMENSAO -2  /**< Saída ou placa de tamanho errado, ou `passo` menor que `nCol`. */
+#define CHROMA_ERRO_MEMORIA -3   /**< Falta de memória para o matte, os planos ou a tabela suave. */
+
+#define CHROMA_ESPACO_RGB 0  /**< Distância euclidiana em RGB. */
+#define CHROMA_ESPACO_CBCR 1 /**< Distância só em Cb e Cr (BT.601, inteiros). */
+
+#define CHROMA_SIMD_AUTO 0    /**< Melhor kernel suportado pelo processador. */
+#define CHROMA_SIMD_ESCALAR 1
+#define CHROMA_SIMD_SSSE3 2
+#define CHROMA_SIMD_AVX2 3
+
+#define CHROMA_RAIO_MAX 100 /**< Raio máximo dos filtros do matte. */
+
+typedef struct Pixel
+{
+    unsigned char R;
+    unsigned char G;
+    unsigned char B;
+} tpPixel;
+
+/**
+ * @brief Pixel de imagens com mais de 8 bits por canal (intensidade máxima > 255).
+ */
+typedef struct Pixel16
+{
+    unsigned short R;
+    unsigned short G;
+    unsigned short B;
+} tpPixel16;
+
+/**
+ * @brief Imagem em memória do chamador.
+ *
+ * A linha `i` começa em `pixels + i * passo`; `passo` (em pixels) pode ser
+ * maior que `nCol` para recortes de uma imagem maior ou linhas com
+ * preenchimento. Com `linhas`, a linha `i` é `linhas[i]` e `pixels` e `passo`
+ * não são usados, para imagens guardadas em vários blocos. Imagens de 16 bits
+ * usam `pixels16` ou `linhas16` do mesmo modo. Campos que não se aplicam
+ * devem ficar zerados.
+ */
+typedef struct Imagem
+{
+    tpPixel *pixels;
+    size_t nLin, nCol;
+    size_t passo;
+    tpPixel **linhas;
+    tpPixel16 *pixels16;
+    tpPixel16 **linhas16;
+} tpImagem;
+
+/**
+ * @brief Resultado de uma chamada de `compor()`, preenchido se pedido em `tpOpcoesChave`.
+ *
+ * As contagens só são feitas com `contar`; os tempos, em segundos, são de
+ * relógio e só valem para a etapa que a composição teve.
+ */
+typedef struct Relatorio
+{
+    size_t fundo, frente, borda; /**< Pixels da região sobreposta que receberam fundo, foreground e mistura. */
+    double tempoContagem;
+    double tempoFiltros; /**< Filtros do matte. */
+    double tempoConversao, tempoComposicao; /**< Conversão de e para planos e composição sobre eles. */
+    const char *kernel; /**< Nome do kernel usado: "escalar", "ssse3", "avx2" ou "suave". */
+} tpRelatorio;
+
+/**
+ * @brief Opções de `compor()`; um ponteiro nulo equivale a tudo zerado.
+ *
+ * Zerado, o foreground inteiro vai para o canto superior esquerdo do fundo,
+ * com chave rígida em RGB e uma thread.
+ */
+typedef struct OpcoesChave
+{
+    int espaco; /**< `CHROMA_ESPACO_RGB` ou `CHROMA_ESPACO_CBCR`. */
+    int despill; /**< Diferente de zero limita o canal dominante da chave no foreground mantido. */
+    const tpImagem *placa; /**< Matte de diferença: placa limpa com as dimensões de `fore`, no lugar da chave. */
+    int diferenca; /**< Matte de diferença sem `placa`: compara com o fundo sob o foreground. */
+    int simd; /**< Nível máximo dos kernels, `CHROMA_SIMD_*`; pedir mais que o processador tem não é erro. */
+    int suave; /**< Opacidade em rampa de `tolerancia` (0) até `tolExterna` (255), por tabela. */
+    int tolExterna;
+    int raioErosao, raioDilatacao, raioCaixa, raioGauss; /**< Filtros do matte, de 0 a `CHROMA_RAIO_MAX`. */
+    int planar; /**< Compõe sobre cópias das imagens em planos R, G e B alinhados. */
+    tpPixel16 chave16; /**< Chave das imagens de 16 bits, no lugar de `chave`. */
+    int deslocX, deslocY; /**< Posição no fundo do canto do foreground (ou do recorte). */
+    int recortar; /**< Usa só o retângulo `recorte*` do foreground; largura ou altura negativa vai até a borda. */
+    int recorteX, recorteY, recorteL, recorteA;
+    int threads; /**< Threads da composição, contando a que chama; 0 ou 1 usa só a que chama. */
+    int contar; /**< Conta os pixels de cada caminho em `relatorio`. */
+    tpRelatorio *relatorio;
+} tpOpcoesChave;
+
+/**
+ * @brief Aplica o Chroma Key de `fore` sobre `back`, gravando em `saida`.
+ *
+ * O foreground (ou o recorte dele) é posicionado em (`deslocX`, `deslocY`)
+ * do background; só a região em que os dois se sobrepõem passa pelo teste de
+ * distância e o resto da saída recebe o fundo. `saida` deve ter as dimensões
+ * de `back` e pode ser a própria `back` (composição no lugar). Em todas as
+ * imagens, `passo` não pode ser menor que `nCol`. A tolerância é limitada a
+ * 0..441 (0..113511 em 16 bits), como na linha de comando, cujo resultado é
+ * idêntico com a mesma chave e opções.
+ *
+ * Imagens de 16 bits não aceitam chave suave, planos, filtros, diferença,
+ * despill nem CbCr; planos só aceitam a chave rígida em RGB; a chave suave
+ * não aceita CbCr nem diferença, e a diferença não aceita filtros nem
+ * despill. Essas combinações devolvem `CHROMA_ERRO_PARAMETRO`.
+ *
+ * @return `CHROMA_OK` ou um dos códigos `CHROMA_ERRO_*`.
+ */
+int compor(const tpImagem *fore, const tpImagem *back, tpPixel chave, int tolerancia, tpImagem *saida, const tpOpcoesChave *opcoes);
+
+#endif
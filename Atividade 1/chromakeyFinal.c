@@ -3,9 +3,16 @@
  * @brief Implementação de um programa de Chroma Key para imagens PPM.
  *
  * Este arquivo contém a lógica para realizar a sobreposição de imagens
- * baseada em uma cor chave (Chroma Key). Ele lê duas imagens no formato PPM (P3),
- * uma de primeiro plano (foreground) com um fundo de cor sólida e outra de
- * fundo (background), e gera uma nova imagem combinada.
+ * baseada em uma cor chave (Chroma Key). Ele lê duas imagens no formato PPM (P3
+ * ou P6), uma de primeiro plano (foreground) com um fundo de cor sólida e outra
+ * de fundo (background), e gera uma nova imagem combinada.
+ *
+ * O formato de cada entrada é detectado pelo cabeçalho, e a saída pode ser
+ * gravada em PPM, PNG ou QOI. Toda composição passa por `compor()`
+ * (`chromakey.c`, exposta em `chromakey.h`); este arquivo trata dos
+ * argumentos, da leitura e da gravação e dos modos de execução (`--stream`,
+ * `--pipeline`, `--seq`, `--bench`). As opções estão descritas em
+ * `abrirArquivos()` e cada modo na função que o implementa.
  *
  * A técnica funciona substituindo pixels na imagem de primeiro plano que são
  * "próximos" a uma cor chave pelos pixels correspondentes da imagem de fundo.
@@ -14,282 +21,3850 @@
  * @author Isaque Passos
  */
 
-#include <stdio.h>
-#include <string.h>
-#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "chromakeyInterno.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHROMA_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SLOTS_PIPELINE 8 /**< Bandas em trânsito no anel do `--pipeline`. */
+#define GIROS_PIPELINE 256 /**< Leituras do contador antes de dormir na variável de condição. */
+#define TAM_BUFFER_LEITURA (1 << 20)
+#define RESERVA_LEITURA 64 /**< Bytes garantidos no buffer antes de um token. */
+#define TAM_BUFFER_ESCRITA (1 << 20)
+#define FASE_ABERTURA 0 /**< Fases medidas por `--stats`. */
+#define FASE_CABECALHO 1
+#define FASE_CARGA 2
+#define FASE_COMPOSICAO 3
+#define FASE_GRAVACAO 4
+#define FASE_LIBERACAO 5
+#define FASE_CONTAGEM 6
+#define NUM_FASES 7
+#define CHAVE_BENCH_G 255 /**< Chave do benchmark: verde puro (0, 255, 0). */
+#define TOL_BENCH 30
+#define TAM_BLOCO ((size_t)64 << 20) /**< Bytes máximos de cada bloco de linhas das imagens. */
+#define AMOSTRAS_AUTO 65536 /**< Pixels amostrados por `--auto`, no máximo. */
+#define SATURACAO_AUTO 64 /**< Diferença mínima entre canais para uma cor contar como saturada. */
+#define QUEDA_AUTO 100 /**< O grupo da chave acaba onde o histograma de distâncias cai a 1/100 do pico. */
+#define BYTES_BANDA_PNG (1 << 20) /**< Bytes filtrados por banda (e por bloco IDAT) da saída PNG. */
+#define HASH_PNG 15 /**< Bits da tabela de hash do LZ77 de cada banda. */
+#define JANELA_DEFLATE 32768
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Banda de linhas da saída PNG, filtrada e comprimida por uma thread.
+ */
+typedef struct BandaPNG
+{
+    unsigned char *dados; /**< Bloco deflate terminado em fronteira de byte. */
+    size_t tam, bytesFiltrados;
+    unsigned int adler, crc; /**< Adler-32 dos bytes filtrados e CRC do chunk IDAT. */
+} tpBandaPNG;
+
+/**
+ * @brief Fluxo de bits do deflate, preenchido a partir do bit menos significativo.
+ */
+typedef struct FluxoBits
+{
+    unsigned char *saida;
+    size_t tam;
+    unsigned long long acumulador;
+    int nBits;
+} tpFluxoBits;
+
+/**
+ * @brief Memória de uma imagem dividida em blocos de no máximo `TAM_BLOCO` bytes.
+ *
+ * Cada bloco guarda `linhasPorBloco` linhas inteiras e contíguas, então uma
+ * imagem de vários gigabytes não depende de um único `malloc` contíguo.
+ */
+typedef struct Blocos
+{
+    unsigned char **base; /**< Início de cada bloco alocado. */
+    size_t nBlocos, linhasPorBloco, bytesLinha;
+} tpBlocos;
+
+/**
+ * @brief Buffer de um quadro da sequência (`--seq`), reaproveitado entre quadros.
+ */
+typedef struct Quadro
+{
+    tpPixel **pixels2D;
+    tpBlocos blocos;
+    size_t nLin, nCol;
+    int cheio;
+} tpQuadro;
+
+/**
+ * @brief Leitor com buffer próprio para os pixels de um arquivo PPM.
+ *
+ * Em P3 o texto é lido em blocos de `TAM_BUFFER_LEITURA` e convertido sem
+ * passar por `fscanf`. O buffer sempre termina com um byte 0 de sentinela, que
+ * encerra o laço de dígitos sem teste de limite.
+ */
+typedef struct Leitor
+{
+    FILE *arq;
+    unsigned char *buffer;
+    size_t pos, tam;
+    size_t lidos; /**< Bytes lidos do arquivo; somados a `bytesLidos` ao liberar. */
+    int fim;
+} tpLeitor;
+
+/**
+ * @brief Slot do anel de bandas do `--pipeline`.
+ *
+ * A banda `k` ocupa o slot `k % SLOTS_PIPELINE`. O fundo é composto no
+ * próprio buffer `back`, que o gravador então grava.
+ */
+typedef struct SlotPipeline
+{
+    tpPixel *back; /**< `LINHAS_BANDA` linhas do background (e da saída). */
+    tpPixel *fore; /**< `LINHAS_BANDA` linhas inteiras do foreground. */
+    atomic_size_t composta; /**< Número da última banda composta neste slot, mais 1. */
+} tpSlotPipeline;
+
+/**
+ * @brief Escritor com buffer próprio para os pixels da imagem de saída.
+ */
+typedef struct Escritor
+{
+    FILE *arq;
+    char *buffer;
+    size_t pos;
+} tpEscritor;
+
+//-----------------------------------------------------------------------------
+
+char infoB[4], infoF[4], infoS[4];
+int maxValB, maxValF;
+size_t nLinB, nLinF, nColB, nColF;
+
+FILE *arqFore, *arqBack, *arqSaida;
+tpLeitor leitorBack, leitorFore;
+char textoValor[256][4]; /**< Valores 0..255 em decimal, seguidos de espaço. */
+unsigned char tamTexto[256];
+
+unsigned char chaveR, chaveG, chaveB;
+int tolerancia;
+int provR, provG, provB, provTol, provTolExterna;
+int espacoCor = ESPACO_RGB;
+int usarDespill;
+int usarDiferenca; /**< `--diff`: chave por diferença para a placa limpa. */
+FILE *arqPlaca; /**< Placa limpa de `--plate`; sem ela, a placa é o próprio background. */
+tpPixel **placa2D;
+tpBlocos blocosPlaca;
+size_t nLinPlaca, nColPlaca;
+int usarAuto;
+int raioErosao, raioDilatacao, raioCaixa, raioGauss;
+unsigned short chave16R, chave16G, chave16B;
+int deslocX, deslocY, recorteX, recorteY, recorteL = -1, recorteA = -1;
+size_t linIni, linFim, colIni, colFim; /**< Região do background coberta pelo foreground. */
+long long desvioLin, desvioCol; /**< Somados a uma posição do background, dão a do foreground. */
+int usarSuave, tolInterna, tolExterna;
+
+tpPixel *back1D, *fore1D; /**< Pixels mapeados com `--mmap`. */
+tpPixel **back2D, **fore2D, **saida2D;
+tpBlocos blocosBack, blocosFore, blocosSaida;
+tpPixel16 **back16, **fore16, **saida16;
+tpBlocos blocosBack16, blocosFore16, blocosSaida16;
+
+int usarMmap, usarStream, usarPlanar;
+double tempoConversaoPlanar, tempoComposicaoPlanar; /**< Devolvidos por `compor()` em `criarImagem()`, para `--stats` e `--bench`. */
+const char *nivelSimd, *nomeKernel = "escalar"; /**< Kernel que `compor()` usou, para `--stats` e `--bench`. */
+int nivelChave = CHROMA_SIMD_AUTO; /**< `--simd` repassado a `compor()`. */
+int usarBench;
+
+int usarStats;
+double paredeFase[NUM_FASES], cpuFase[NUM_FASES], inicioParede[NUM_FASES], inicioCPU[NUM_FASES];
+const char *nomesFases[NUM_FASES] = {"open", "header", "load", "composite", "write", "free", "count"};
+size_t bytesLidos, bytesGravados;
+
+tpBandaPNG *bandasPNG;
+size_t linhasBandaPNG;
+unsigned int tabelaCRC[256];
+unsigned short codigoLiteral[288]; /**< Códigos Huffman fixos do deflate, com os bits já invertidos. */
+unsigned char bitsLiteral[288];
+unsigned char indiceComprimento[259], indiceDistancia[512];
+static const unsigned short baseComprimento[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char extraComprimento[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short baseDistancia[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const unsigned char extraDistancia[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+size_t contFundo, contFrente, contBorda; /**< Pixels que receberam fundo, foreground e média. */
+size_t larguraBench, alturaBench;
+double coberturaBench;
+int numThreads = 1, relatorioThreads;
+
+pthread_t *threadsPool;
+pthread_mutex_t mutexPool = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t condTarefa = PTHREAD_COND_INITIALIZER, condFim = PTHREAD_COND_INITIALIZER;
+void (*tarefaPool)(int banda, void *arg);
+void *argPool;
+int proximaBanda, totalBandas, bandasPendentes, geracaoPool, fimPool;
+
+int usarSeq, primeiroQuadro, ultimoQuadro;
+char *padraoFore, *padraoSaida;
+tpQuadro entradas[2], saidas[2];
+pthread_mutex_t mutexSeq = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t condSeq = PTHREAD_COND_INITIALIZER;
+unsigned char *mapaBack, *mapaFore;
+
+int usarPipeline, trabalhadoresPipeline;
+tpSlotPipeline slotsPipeline[SLOTS_PIPELINE];
+atomic_size_t bandasLidasBack, bandasLidasFore, bandasGravadas; /**< Bandas concluídas por estágio. */
+atomic_int dormindoPipeline; /**< Threads bloqueadas em `condPipeline`. */
+pthread_mutex_t mutexPipeline = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t condPipeline = PTHREAD_COND_INITIALIZER;
+size_t totalBandasPipeline;
+double *ocupadoPipeline; /**< Tempo útil de cada thread: fundo, foreground, gravador e trabalhadores. */
+size_t tamMapaBack, tamMapaFore;
+
+//-----------------------------------------------------------------------------
+
+void abrirArquivos(int argc, char *argv[]);
+int lerRaio(const char *texto);
+int lerInteiro(const char *texto, const char *nome);
+int valoresOpcao(const char *opcao);
+void imprimirUso(void);
+size_t lerValorCabecalho(FILE *arq);
+void lerCabecalhos(void);
+void validarDados(void);
+void calcularSobreposicao(void);
+tpPixel *mapearPixels(FILE *arq, size_t total, int escrita, unsigned char **mapa, size_t *tamMapa);
+void reservarBlocos(tpBlocos *blocos, size_t nLin, size_t bytesLinha);
+unsigned char *linhaBloco(const tpBlocos *blocos, size_t i);
+void liberarBlocos(tpBlocos *blocos);
+tpPixel **reservarImagem(tpBlocos *blocos, size_t nLin, size_t nCol);
+tpPixel16 **reservarImagem16(tpBlocos *blocos, size_t nLin, size_t nCol);
+void alocarImagens(void);
+void iniciarLeitor(tpLeitor *leitor, FILE *arq);
+void liberarLeitor(tpLeitor *leitor);
+void recarregarLeitor(tpLeitor *leitor);
+void lerBytes(tpLeitor *leitor, void *destino, size_t n);
+unsigned int lerValorP3(tpLeitor *leitor);
+void lerCanaisP3(tpLeitor *leitor, void *canais, size_t n, int bytesCanal);
+void lerLinha(tpLeitor *leitor, const char *info, tpPixel *linha, size_t nCol);
+void lerLinha16(tpLeitor *leitor, const char *info, tpPixel16 *linha, size_t nCol);
+void iniciarEscritor(tpEscritor *escritor, FILE *arq);
+void descarregarEscritor(tpEscritor *escritor);
+void liberarEscritor(tpEscritor *escritor);
+void escreverLinha(tpEscritor *escritor, const tpPixel *linha, size_t nCol);
+void escreverLinha16(tpEscritor *escritor, const tpPixel16 *linha, size_t nCol);
+void escreverCabecalho(FILE *arq);
+void gravarImagem(FILE *arq, tpPixel **img2D);
+void gravarBytes(FILE *arq, const void *dados, size_t n);
+void iniciarTabelasPNG(void);
+unsigned int atualizarCRC(unsigned int crc, const unsigned char *dados, size_t n);
+unsigned int calcularAdler(const unsigned char *dados, size_t n);
+unsigned int combinarAdler(unsigned int adler1, unsigned int adler2, size_t tam2);
+void filtrarLinhaPNG(unsigned char *destino, const unsigned char *linha, const unsigned char *anterior, size_t bytes);
+void emitirBits(tpFluxoBits *fluxo, unsigned int valor, int bits);
+size_t comprimirDeflate(unsigned char *saida, const unsigned char *dados, size_t n, int *cabecas);
+void codificarBandaPNG(int banda, void *arg);
+void escreverChunkPNG(FILE *arq, const char *tipo, const unsigned char *dados, size_t n);
+void gravarPNG(FILE *arq, tpPixel **img2D);
+void gravarQOI(FILE *arq, tpPixel **img2D);
+void lerPixels(tpLeitor *leitor, const char *info, tpPixel **img2D, size_t nLin, size_t nCol);
+void guardaImagens(void);
+void carregarPlaca(void);
+void detectarChave(void);
+void selecionarKernel(void);
+double tempoAtual(void);
+double tempoCPU(void);
+void iniciarFase(int fase);
+void encerrarFase(int fase);
+void imprimirEstatisticas(const char *modo);
+void *trabalhadorPool(void *arg);
+void iniciarPool(void);
+void executarBandas(void (*tarefa)(int banda, void *arg), void *arg, int nBandas);
+void encerrarPool(void);
+tpImagem imagemLinhas(tpPixel **linhas, size_t nLin, size_t nCol);
+tpImagem imagemLinhas16(tpPixel16 **linhas, size_t nLin, size_t nCol);
+tpImagem imagemContigua(tpPixel *pixels, size_t nLin, size_t nCol);
+void montarOpcoes(tpOpcoesChave *opcoes, tpRelatorio *relatorio);
+void montarOpcoesFaixa(tpOpcoesChave *opcoes, tpRelatorio *relatorio);
+void comporImagem(const tpImagem *fore, const tpImagem *back, tpImagem *saida, const tpOpcoesChave *opcoes);
+void criarImagem(void);
+void gravarSaida(void);
+void criarImagemStream(void);
+void aguardarContador(atomic_size_t *contador, size_t alvo);
+void publicarContador(atomic_size_t *contador, size_t valor);
+void *leitorPipelineBack(void *arg);
+void *leitorPipelineFore(void *arg);
+void *compositorPipeline(void *arg);
+void *gravadorPipeline(void *arg);
+void criarImagemPipeline(void);
+void criarImagem16(void);
+void lerQuadro(int numero, tpQuadro *q);
+void gravarQuadro(int numero, tpPixel **img2D);
+void *leitorSequencia(void *arg);
+void *gravadorSequencia(void *arg);
+void criarSequencia(void);
+unsigned int proximoAleatorio(unsigned int *estado);
+size_t gerarImagemSintetica(FILE *arq, size_t nLin, size_t nCol, double cobertura, unsigned int semente);
+void executarBenchmark(void);
+void liberaAlocacoes(void);
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Abre os arquivos e processa os argumentos da linha de comando.
+ *
+ * Opções (podem aparecer em qualquer posição):
+ *  --format P3|P6  formato da imagem de saída. Por padrão é P6 quando as duas
+ *                  entradas são P6 e P3 nos demais casos.
+ *  --mmap          mapeia as entradas P6 de 8 bits em memória em vez de
+ *                  copiá-las; o fundo mapeado recebe a própria composição.
+ *  --stream        compõe linha a linha, sem carregar as imagens inteiras.
+ *  --pipeline      como --stream, mas leitura, composição (--threads N) e
+ *                  gravação rodam em threads separadas, sobrepostas.
+ *  --simd NIVEL    força o kernel de composição: escalar, ssse3 ou avx2.
+ *  --threads N     compõe com N threads (0 = uma por núcleo) e informa a vazão.
+ *  --seq A B       modo sequência: <imgForeground> e <imgSaida> são padrões
+ *                  no estilo printf (ex.: fg_%05d.ppm) e os quadros A..B são
+ *                  compostos sobre o mesmo background.
+ *  --soft EXT      chave suave: opacidade cresce linearmente da <tolerancia>
+ *                  até a tolerância externa EXT.
+ *  --planar        compõe sobre planos R, G, B alinhados (chave rígida).
+ *  --espaco E      espaço da distância à chave: rgb (padrão) ou cbcr, que
+ *                  ignora a luminância e tolera fundo com iluminação desigual.
+ *  --despill       limita o canal dominante da chave nos pixels mantidos do
+ *                  foreground ao maior dos outros dois (remove reflexo verde).
+ *  --erode R       erosão (mínimo) do matte em janela (2R+1)x(2R+1).
+ *  --dilate R      dilatação (máximo) do matte, aplicada depois da erosão.
+ *  --blur R        média em caixa (2R+1)x(2R+1) do matte, para bordas suaves.
+ *  --gauss R       três médias em caixa seguidas, aproximando uma gaussiana.
+ *  --auto          detecta a chave e a tolerância pelo foreground; os
+ *                  argumentos de chave e tolerância podem ser omitidos.
+ *  --diff          matte de diferença: em vez de uma cor chave, cada pixel do
+ *                  foreground é comparado ao pixel do background na mesma
+ *                  posição (a placa limpa); só a tolerância é passada.
+ *  --plate ARQ     como --diff, mas a placa é ARQ, com as dimensões do
+ *                  foreground, comparada pixel a pixel com ele.
+ *  --offset X Y    posição do canto superior esquerdo do foreground no
+ *                  background; pode ser negativa ou passar da borda.
+ *  --crop X Y L A  usa só o retângulo L x A do foreground que começa em (X, Y).
+ *  --stats         ao final, imprime em stdout uma linha JSON com tempos por
+ *                  fase, bytes lidos e gravados e contagem de pixels.
+ *  --bench LxA C   benchmark: gera imagens sintéticas L x A com C% de pixels
+ *                  na cor chave e mede cada fase; dispensa os arquivos.
+ *
+ * Se <imgSaida> termina em `.png` ou `.qoi`, a saída é gravada nesse formato
+ * (`infoS` passa a ser "PNG" ou "QOI") em vez de PPM.
+ *
+ * Uma opção seguida de menos valores que os seus (`valoresOpcao()`) imprime a
+ * linha de uso e encerra com erro.
+ */
+void abrirArquivos(int argc, char *argv[])
+{
+    char *pos[7];
+    const char *extensao;
+    int nPos = 0;
+
+    infoS[0] = '\0';
+
+    for (int i = 1; i < argc; i++){
+
+        if (i + valoresOpcao(argv[i]) >= argc){
+
+            imprimirUso();
+            exit(1);
+        }
+
+        if (strcmp(argv[i], "--format") == 0){
+
+            i++;
+
+            if (strcmp(argv[i], "P3") != 0 && strcmp(argv[i], "P6") != 0){
+
+                printf("Formato de saida invalido: use P3 ou P6.\n");
+                exit(1);
+            }
+
+            strcpy(infoS, argv[i]);
+        }
+
+        else if (strcmp(argv[i], "--mmap") == 0) usarMmap = 1;
+
+        else if (strcmp(argv[i], "--stream") == 0) usarStream = 1;
+
+        else if (strcmp(argv[i], "--pipeline") == 0) usarPipeline = 1;
+
+        else if (strcmp(argv[i], "--planar") == 0) usarPlanar = 1;
+
+        else if (strcmp(argv[i], "--stats") == 0) usarStats = 1;
+
+        else if (strcmp(argv[i], "--despill") == 0) usarDespill = 1;
+
+        else if (strcmp(argv[i], "--auto") == 0) usarAuto = 1;
+
+        else if (strcmp(argv[i], "--diff") == 0) usarDiferenca = 1;
+
+        else if (strcmp(argv[i], "--plate") == 0){
+
+            usarDiferenca = 1;
+            arqPlaca = fopen(argv[++i], "rb");
+
+            if (arqPlaca == NULL){
+
+                printf("Erro ao abrir a placa limpa.\n");
+                exit(1);
+            }
+        }
+
+        else if (strcmp(argv[i], "--erode") == 0) raioErosao = lerRaio(argv[++i]);
+
+        else if (strcmp(argv[i], "--dilate") == 0) raioDilatacao = lerRaio(argv[++i]);
+
+        else if (strcmp(argv[i], "--blur") == 0) raioCaixa = lerRaio(argv[++i]);
+
+        else if (strcmp(argv[i], "--gauss") == 0) raioGauss = lerRaio(argv[++i]);
+
+        else if (strcmp(argv[i], "--espaco") == 0){
+
+            i++;
+
+            if (strcmp(argv[i], "rgb") == 0) espacoCor = ESPACO_RGB;
+            else if (strcmp(argv[i], "cbcr") == 0) espacoCor = ESPACO_CBCR;
+            else{
+
+                printf("Espaco de cor invalido: use rgb ou cbcr.\n");
+                exit(1);
+            }
+        }
+
+        else if (strcmp(argv[i], "--simd") == 0) nivelSimd = argv[++i];
+
+        else if (strcmp(argv[i], "--threads") == 0){
+
+            numThreads = atoi(argv[++i]);
+            relatorioThreads = 1;
+
+            if (numThreads <= 0) numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            if (numThreads <= 0) numThreads = 1;
+        }
+
+        else if (strcmp(argv[i], "--seq") == 0){
+
+            usarSeq = 1;
+            primeiroQuadro = atoi(argv[++i]);
+            ultimoQuadro = atoi(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--soft") == 0){
+
+            usarSuave = 1;
+            provTolExterna = atoi(argv[++i]);
+        }
+
+        else if (strcmp(argv[i], "--offset") == 0){
+
+            deslocX = lerInteiro(argv[++i], "deslocamento");
+            deslocY = lerInteiro(argv[++i], "deslocamento");
+        }
+
+        else if (strcmp(argv[i], "--crop") == 0){
+
+            recorteX = lerInteiro(argv[++i], "recorte");
+            recorteY = lerInteiro(argv[++i], "recorte");
+            recorteL = lerInteiro(argv[++i], "recorte");
+            recorteA = lerInteiro(argv[++i], "recorte");
+
+            if (recorteL < 0 || recorteA < 0){
+
+                printf("Largura e altura do recorte nao podem ser negativas.\n");
+                exit(1);
+            }
+        }
+
+        else if (strcmp(argv[i], "--bench") == 0){
+
+            usarBench = 1;
+
+            if (sscanf(argv[++i], "%zux%zu", &larguraBench, &alturaBench) != 2 || larguraBench == 0 || alturaBench == 0){
+
+                printf("Resolucao do benchmark invalida: use LARGURAxALTURA.\n");
+                exit(1);
+            }
+
+            coberturaBench = atof(argv[++i]);
+        }
+
+
+        else if (nPos < 7) pos[nPos++] = argv[i];
+    }
+
+    if (usarBench) return;
+
+    if (nPos < 7 && !(usarAuto && nPos >= 3) && !(usarDiferenca && nPos >= 4)){
+
+        imprimirUso();
+        exit(0);
+    }
+
+    extensao = strrchr(pos[2], '.');
+
+    if (extensao != NULL && (strcasecmp(extensao, ".png") == 0 || strcasecmp(extensao, ".qoi") == 0)){
+
+        if (infoS[0] != '\0' || usarStream || usarPipeline || usarSeq){
+
+            printf("Saida PNG ou QOI nao aceita --format, --stream, --pipeline e --seq.\n");
+            exit(1);
+        }
+
+        strcpy(infoS, strcasecmp(extensao, ".png") == 0 ? "PNG" : "QOI");
+    }
+
+    if (usarSeq){
+
+        static char nomePrimeiro[4096];
+
+        if (usarStream || usarStats || primeiroQuadro > ultimoQuadro){
+
+            printf("Use --seq com primeiro <= ultimo e sem --stream ou --stats.\n");
+            exit(1);
+        }
+
+        padraoFore = pos[0];
+        padraoSaida = pos[2];
+        snprintf(nomePrimeiro, sizeof(nomePrimeiro), padraoFore, primeiroQuadro);
+        pos[0] = nomePrimeiro;
+    }
+
+    arqFore = fopen(pos[0], "rb");
+    arqBack = fopen(pos[1], "rb");
+
+    if (arqFore == NULL || arqBack == NULL){
+
+        printf("Erro ao abrir algum dos arquivos\n");
+        exit(1);
+    }
+
+    if (!usarSeq) arqSaida = fopen(pos[2], "wb");
+
+    if (arqSaida == NULL && !usarSeq){
+
+        printf("Erro ao criar arquivo de saida\n");
+        exit(1);
+    }
+
+    if (usarAuto) return;
+
+    if (usarDiferenca && nPos < 7){
+
+        provTol = atoi(pos[3]);
+        return;
+    }
+
+    provR = atoi(pos[3]);
+    provG = atoi(pos[4]);
+    provB = atoi(pos[5]);
+    provTol = atoi(pos[6]);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Converte o raio de um filtro do matte, entre 0 e `CHROMA_RAIO_MAX`.
+ */
+int lerRaio(const char *texto)
+{
+    int raio = atoi(texto);
+
+    if (raio < 0 || raio > CHROMA_RAIO_MAX){
+
+        printf("Raio de filtro invalido: use de 0 a %d.\n", CHROMA_RAIO_MAX);
+        exit(1);
+    }
+
+    return raio;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Converte um argumento inteiro com sinal (`--offset`, `--crop`).
+ *
+ * O texto inteiro precisa ser um número que caiba em um `int`; `nome` aparece
+ * na mensagem de erro.
+ */
+int lerInteiro(const char *texto, const char *nome)
+{
+    char *fim;
+    long valor;
+
+    errno = 0;
+    valor = strtol(texto, &fim, 10);
+
+    if (fim == texto || *fim != '\0' || errno == ERANGE || valor < INT_MIN || valor > INT_MAX){
+
+        printf("Valor de %s invalido: %s\n", nome, texto);
+        exit(1);
+    }
+
+    return (int)valor;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Número de valores que seguem a opção `opcao` na linha de comando.
+ *
+ * Argumentos que não são opções com valor devolvem 0.
+ */
+int valoresOpcao(const char *opcao)
+{
+    static const char *opcoes1[] = {"--format", "--plate", "--erode", "--dilate", "--blur", "--gauss",
+                                    "--espaco", "--simd", "--threads", "--soft"};
+    static const char *opcoes2[] = {"--seq", "--offset", "--bench"};
+
+    for (size_t k = 0; k < sizeof(opcoes1) / sizeof(opcoes1[0]); k++)
+        if (strcmp(opcao, opcoes1[k]) == 0) return 1;
+
+    for (size_t k = 0; k < sizeof(opcoes2) / sizeof(opcoes2[0]); k++)
+        if (strcmp(opcao, opcoes2[k]) == 0) return 2;
+
+    if (strcmp(opcao, "--crop") == 0) return 4;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Imprime a linha de uso do programa.
+ */
+void imprimirUso()
+{
+    printf("Instr. de uso: <prog> <imgForeground> <imgBackground> <imgSaida> <chaveR> <chaveG> <chaveB> <tolerancia> [--format P3|P6] [--mmap] [--stream] [--pipeline] [--simd escalar|ssse3|avx2] [--threads N] [--seq primeiro ultimo] [--soft tolExterna] [--planar] [--espaco rgb|cbcr] [--despill] [--auto] [--diff] [--plate arq] [--erode r] [--dilate r] [--blur r] [--gauss r] [--offset x y] [--crop x y largura altura] [--stats]\n       <imgSaida> terminada em .png ou .qoi grava nesse formato\n       <prog> <imgForeground> <imgBackground> <imgSaida> --auto [opcoes]\n       <prog> <imgForeground> <imgBackground> <imgSaida> <tolerancia> --diff|--plate arq [opcoes]\n       <prog> --bench LARGURAxALTURA cobertura%% [opcoes]\n\n");
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê um valor numérico do cabeçalho PPM, ignorando espaços e comentários.
+ *
+ * Consome exatamente um caractere de espaço após o número, como exige o formato
+ * P6 (os dados binários começam logo em seguida).
+ */
+size_t lerValorCabecalho(FILE *arq)
+{
+    int c = fgetc(arq);
+    size_t valor = 0;
+
+    while (c == '#' || (c != EOF && strchr(" \t\r\n", c) != NULL)){
+
+        if (c == '#'){
+
+            while (c != '\n' && c != EOF) c = fgetc(arq);
+        }
+
+        c = fgetc(arq);
+    }
+
+    if (c < '0' || c > '9'){
+
+        printf("Cabecalho PPM invalido.\n");
+        exit(1);
+    }
+
+    while (c >= '0' && c <= '9'){
+
+        if (valor > (SIZE_MAX - 9) / 10){
+
+            printf("Cabecalho PPM invalido.\n");
+            exit(1);
+        }
+
+        valor = valor * 10 + (c - '0');
+        c = fgetc(arq);
+    }
+
+    return valor;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê os cabeçalhos das imagens PPM (P3 ou P6).
+ *
+ * Dimensões nulas e intensidade máxima 0 são rejeitadas como cabeçalho
+ * inválido: não há imagem a compor nem um PPM válido a gravar.
+ */
+void lerCabecalhos(void)
+{
+    if (fscanf(arqBack, "%3s", infoB) != 1 || fscanf(arqFore, "%3s", infoF) != 1){
+
+        printf("Cabecalho PPM invalido.\n");
+        exit(1);
+    }
+
+    size_t maxB, maxF;
+
+    nColB = lerValorCabecalho(arqBack);
+    nLinB = lerValorCabecalho(arqBack);
+    maxB = lerValorCabecalho(arqBack);
+
+    nColF = lerValorCabecalho(arqFore);
+    nLinF = lerValorCabecalho(arqFore);
+    maxF = lerValorCabecalho(arqFore);
+
+    if (nColB == 0 || nLinB == 0 || maxB == 0 || nColF == 0 || nLinF == 0 || maxF == 0){
+
+        printf("Cabecalho PPM invalido.\n");
+        exit(1);
+    }
+
+    if (maxB > 65535 || maxF > 65535){
+
+        printf("Intensidade maxima acima de 65535 nao suportada.\n");
+        exit(1);
+    }
+
+    /* Uma linha de 16 bits e a tabela de linhas precisam caber em size_t. */
+    if ((nColB > 0 && nLinB > SIZE_MAX / sizeof(tpPixel16) / nColB) ||
+        (nColF > 0 && nLinF > SIZE_MAX / sizeof(tpPixel16) / nColF)){
+
+        printf("Dimensoes de imagem grandes demais.\n");
+        exit(1);
+    }
+
+    maxValB = (int)maxB;
+    maxValF = (int)maxF;
+
+    bytesLidos += (size_t)ftell(arqBack) + (size_t)ftell(arqFore);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Valida todos os dados de entrada para garantir a consistência.
+ *
+ * Em imagens de mais de 8 bits a chave vai de 0 à intensidade máxima e a
+ * tolerância até a diagonal do cubo RGB nessa escala.
+ */
+void validarDados()
+{
+    int limite = maxValB > 255 ? maxValB : 255;
+    int tolMaxima = maxValB > 255 ? (int)ceil(sqrt(3.0) * maxValB) : 441;
+
+    if (provR > limite || provR < 0 || provG > limite || provG < 0 || provB > limite || provB < 0){
+
+        printf("Insira apenas valores entre 0 e %d para RGB\n", limite);
+        exit(1);
+    }
+
+    chaveR = provR;
+    chaveG = provG;
+    chaveB = provB;
+    chave16R = provR;
+    chave16G = provG;
+    chave16B = provB;
+
+    if (provTol > tolMaxima) tolerancia = tolMaxima;
+    else if (provTol < 0) tolerancia = 0;
+    else tolerancia = provTol;
+
+    tolInterna = tolerancia;
+
+    if (provTolExterna > 441) tolExterna = 441;
+    else if (provTolExterna < tolInterna) tolExterna = tolInterna;
+    else tolExterna = provTolExterna;
+
+    if ((strcmp(infoB, "P3") != 0 && strcmp(infoB, "P6") != 0) ||
+        (strcmp(infoF, "P3") != 0 && strcmp(infoF, "P6") != 0)){
+
+        printf("Ambos arquivos devem ter o formato P3 ou P6.\n");
+        exit(1);
+    }
+
+    if (infoS[0] == '\0'){
+
+        if (strcmp(infoB, "P6") == 0 && strcmp(infoF, "P6") == 0) strcpy(infoS, "P6");
+        else strcpy(infoS, "P3");
+    }
+
+    calcularSobreposicao();
+
+    if (maxValB != maxValF){
+
+        printf("Os arquivos tem maxima intensidade diferente.\n");
+        exit(1);
+    }
+
+    if (maxValB > 255 && (usarStream || usarSeq || usarSuave || usarPlanar)){
+
+        printf("As opcoes --stream, --seq, --soft e --planar aceitam apenas imagens de 8 bits.\n");
+        exit(1);
+    }
+
+    if (usarPlanar && (usarSuave || usarStream || usarSeq)){
+
+        printf("A opcao --planar nao aceita --soft, --stream e --seq.\n");
+        exit(1);
+    }
+
+    if ((raioErosao || raioDilatacao || raioCaixa || raioGauss) && (maxValB > 255 || usarPlanar || usarStream || usarSeq)){
+
+        printf("Os filtros do matte aceitam apenas imagens de 8 bits, sem --planar, --stream e --seq.\n");
+        exit(1);
+    }
+
+    if ((strcmp(infoS, "PNG") == 0 || strcmp(infoS, "QOI") == 0) && maxValB != 255){
+
+        printf("Saida PNG ou QOI aceita apenas imagens com intensidade maxima 255.\n");
+        exit(1);
+    }
+
+    /* O IHDR do PNG guarda largura e altura em 31 bits; o cabeçalho do QOI, em 32. */
+    if ((strcmp(infoS, "PNG") == 0 && (nColB > 0x7FFFFFFFu || nLinB > 0x7FFFFFFFu)) ||
+        (strcmp(infoS, "QOI") == 0 && (nColB > 0xFFFFFFFFu || nLinB > 0xFFFFFFFFu))){
+
+        printf("Dimensoes grandes demais para a saida %s.\n", infoS);
+        exit(1);
+    }
+
+    if (usarPipeline && (maxValB > 255 || usarStream || usarSeq || usarStats || usarPlanar || usarAuto ||
+                         raioErosao || raioDilatacao || raioCaixa || raioGauss)){
+
+        printf("A opcao --pipeline aceita apenas imagens de 8 bits, sem --stream, --seq, --stats, --planar, --auto e filtros do matte.\n");
+        exit(1);
+    }
+
+    if (usarDiferenca && (maxValB > 255 || usarStream || usarPipeline || usarSuave || usarPlanar || usarDespill || usarAuto ||
+                          raioErosao || raioDilatacao || raioCaixa || raioGauss)){
+
+        printf("As opcoes --diff e --plate aceitam apenas imagens de 8 bits, sem --stream, --pipeline, --soft, --planar, --despill, --auto e filtros do matte.\n");
+        exit(1);
+    }
+
+    if (usarAuto && (maxValB > 255 || usarStream || usarSeq)){
+
+        printf("A opcao --auto aceita apenas imagens de 8 bits, sem --stream e --seq.\n");
+        exit(1);
+    }
+
+    if (usarMmap && ((strcmp(infoB, "P6") != 0 && (usarSeq || strcmp(infoF, "P6") != 0)) || maxValB > 255 || usarStream || usarPipeline)){
+
+        printf("A opcao --mmap aceita apenas entradas P6 de 8 bits, sem --stream e --pipeline.\n");
+        exit(1);
+    }
+
+    if (usarDespill && (maxValB > 255 || usarPlanar)){
+
+        printf("A opcao --despill aceita apenas imagens de 8 bits, sem --planar.\n");
+        exit(1);
+    }
+
+    if (espacoCor == ESPACO_CBCR && (maxValB > 255 || usarSuave || usarPlanar)){
+
+        printf("A opcao --espaco cbcr aceita apenas imagens de 8 bits, sem --soft e --planar.\n");
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Calcula a região do background coberta pelo foreground posicionado.
+ *
+ * O recorte de `--crop` (ou o foreground inteiro) é colocado com o canto em
+ * (`deslocX`, `deslocY`), limitado às bordas do foreground e cortado nas
+ * bordas do background. A parte de um recorte que começa antes do foreground
+ * (origem negativa) fica vazia, então o resto não se desloca. Fora de [linIni, linFim) x [colIni, colFim) a saída é
+ * cópia do fundo; sem sobreposição, a região fica vazia.
+ */
+void calcularSobreposicao()
+{
+    long long x0 = recorteX > 0 ? recorteX : 0, y0 = recorteY > 0 ? recorteY : 0;
+    long long x1 = (long long)nColF, y1 = (long long)nLinF;
+    long long destX = deslocX + (x0 - recorteX), destY = deslocY + (y0 - recorteY);
+    long long ini, fim;
+
+    if (recorteL >= 0 && (long long)recorteX + recorteL < x1) x1 = (long long)recorteX + recorteL;
+    if (recorteA >= 0 && (long long)recorteY + recorteA < y1) y1 = (long long)recorteY + recorteA;
+
+    linIni = linFim = colIni = colFim = 0;
+    desvioCol = x0 - destX;
+    desvioLin = y0 - destY;
+
+    if (x1 <= x0 || y1 <= y0) return;
+
+    ini = destX > 0 ? destX : 0;
+    fim = destX + (x1 - x0) < (long long)nColB ? destX + (x1 - x0) : (long long)nColB;
+
+    if (fim <= ini) return;
+
+    colIni = (size_t)ini;
+    colFim = (size_t)fim;
+
+    ini = destY > 0 ? destY : 0;
+    fim = destY + (y1 - y0) < (long long)nLinB ? destY + (y1 - y0) : (long long)nLinB;
+
+    if (fim <= ini){
+
+        colIni = colFim = 0;
+        return;
+    }
+
+    linIni = (size_t)ini;
+    linFim = (size_t)fim;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Mapeia os pixels de uma imagem P6 já posicionada após o cabeçalho.
+ *
+ * O mapeamento é privado: com `escrita`, as páginas alteradas viram cópias na
+ * memória do processo e o arquivo não muda. O kernel é avisado de que o acesso
+ * será sequencial, para que faça a leitura antecipada durante a composição.
+ * Retorna NULL se o mapeamento não for possível; nesse caso a imagem segue pelo
+ * caminho com cópia.
+ */
+tpPixel *mapearPixels(FILE *arq, size_t total, int escrita, unsigned char **mapa, size_t *tamMapa)
+{
+#ifdef CHROMA_MMAP
+    struct stat info;
+    long inicio = ftell(arq);
+    void *p;
+
+    if (inicio < 0 || fstat(fileno(arq), &info) != 0) return NULL;
+    if ((size_t)info.st_size < (size_t)inicio + sizeof(tpPixel) * total) return NULL;
+
+    p = mmap(NULL, info.st_size, escrita ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fileno(arq), 0);
+
+    if (p == MAP_FAILED) return NULL;
+
+    madvise(p, info.st_size, MADV_SEQUENTIAL);
+
+    *mapa = (unsigned char *)p;
+    *tamMapa = info.st_size;
+
+    return (tpPixel *)(*mapa + inicio);
+#else
+    (void)arq; (void)total; (void)escrita; (void)mapa; (void)tamMapa;
+    return NULL;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Reserva `nLin` linhas de `bytesLinha` bytes em blocos de até `TAM_BLOCO`.
+ *
+ * Uma linha maior que `TAM_BLOCO` fica sozinha no seu bloco.
+ */
+void reservarBlocos(tpBlocos *blocos, size_t nLin, size_t bytesLinha)
+{
+    blocos->bytesLinha = bytesLinha;
+    blocos->linhasPorBloco = bytesLinha > 0 && bytesLinha < TAM_BLOCO ? TAM_BLOCO / bytesLinha : 1;
+    blocos->nBlocos = (nLin + blocos->linhasPorBloco - 1) / blocos->linhasPorBloco;
+    blocos->base = (unsigned char **)calloc(blocos->nBlocos + 1, sizeof(unsigned char *));
+
+    if (blocos->base == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    for (size_t b = 0; b < blocos->nBlocos; b++){
+
+        size_t linhas = nLin - b * blocos->linhasPorBloco;
+
+        if (linhas > blocos->linhasPorBloco) linhas = blocos->linhasPorBloco;
+
+        blocos->base[b] = (unsigned char *)malloc(linhas * bytesLinha + 1);
+
+        if (blocos->base[b] == NULL){
+
+            printf("Erro ao alocar.\n");
+            exit(1);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Endereço da linha `i` de uma imagem guardada em blocos.
+ */
+unsigned char *linhaBloco(const tpBlocos *blocos, size_t i)
+{
+    return blocos->base[i / blocos->linhasPorBloco] + (i % blocos->linhasPorBloco) * blocos->bytesLinha;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Libera os blocos de uma imagem (nada faz se ela não foi reservada).
+ */
+void liberarBlocos(tpBlocos *blocos)
+{
+    if (blocos->base != NULL){
+
+        for (size_t b = 0; b < blocos->nBlocos; b++) free(blocos->base[b]);
+    }
+
+    free(blocos->base);
+    blocos->base = NULL;
+    blocos->nBlocos = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Reserva uma imagem de `nLin` x `nCol` pixels e devolve a tabela de linhas.
+ */
+tpPixel **reservarImagem(tpBlocos *blocos, size_t nLin, size_t nCol)
+{
+    tpPixel **linhas = (tpPixel **)malloc(sizeof(tpPixel *) * (nLin + 1));
+
+    if (linhas == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    reservarBlocos(blocos, nLin, sizeof(tpPixel) * nCol);
+
+    for (size_t i = 0; i < nLin; i++) linhas[i] = (tpPixel *)linhaBloco(blocos, i);
+
+    return linhas;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão de `reservarImagem()` para pixels de 16 bits.
+ */
+tpPixel16 **reservarImagem16(tpBlocos *blocos, size_t nLin, size_t nCol)
+{
+    tpPixel16 **linhas = (tpPixel16 **)malloc(sizeof(tpPixel16 *) * (nLin + 1));
+
+    if (linhas == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    reservarBlocos(blocos, nLin, sizeof(tpPixel16) * nCol);
+
+    for (size_t i = 0; i < nLin; i++) linhas[i] = (tpPixel16 *)linhaBloco(blocos, i);
+
+    return linhas;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Aloca a memória necessária para armazenar as duas imagens e a saída.
+ *
+ * Cada imagem é reservada em blocos de linhas (`reservarImagem()`). Com
+ * `--mmap`, entradas P6 apontam direto para o arquivo mapeado, e a saída é o
+ * próprio fundo mapeado: a composição escreve sobre ele e só as páginas
+ * alteradas ocupam memória, em vez de uma terceira imagem inteira. Isso não
+ * vale para `--seq` e `--bench`, que compõem várias vezes sobre o mesmo fundo,
+ * nem para `--diff` sem `--plate`, em que o fundo é também a placa.
+ */
+void alocarImagens()
+{
+    int saidaNoFundo = !usarSeq && !usarBench && !(usarDiferenca && arqPlaca == NULL);
+
+    if (usarMmap && strcmp(infoB, "P6") == 0)
+        back1D = mapearPixels(arqBack, nLinB * nColB, saidaNoFundo, &mapaBack, &tamMapaBack);
+
+    if (usarMmap && !usarSeq && strcmp(infoF, "P6") == 0)
+        fore1D = mapearPixels(arqFore, nLinF * nColF, 0, &mapaFore, &tamMapaFore);
+
+    if (back1D != NULL) bytesLidos += sizeof(tpPixel) * nLinB * nColB;
+    if (fore1D != NULL) bytesLidos += sizeof(tpPixel) * nLinF * nColF;
+
+    if (back1D == NULL) back2D = reservarImagem(&blocosBack, nLinB, nColB);
+    if (fore1D == NULL) fore2D = reservarImagem(&blocosFore, nLinF, nColF);
+
+    if (back1D != NULL){
+
+        back2D = (tpPixel **)malloc(sizeof(tpPixel *) * (nLinB + 1));
+
+        if (back2D == NULL){
+
+            printf("Erro ao alocar.\n");
+            liberaAlocacoes();
+            exit(1);
+        }
+
+        for (size_t i = 0; i < nLinB; i++) back2D[i] = back1D + i * nColB;
+    }
+
+    if (back1D != NULL && saidaNoFundo) saida2D = back2D;
+    else saida2D = reservarImagem(&blocosSaida, nLinB, nColB);
+
+    if (fore1D != NULL){
+
+        fore2D = (tpPixel **)malloc(sizeof(tpPixel *) * (nLinF + 1));
+
+        if (fore2D == NULL){
+
+            printf("Erro ao alocar.\n");
+            liberaAlocacoes();
+            exit(1);
+        }
+
+        for (size_t i = 0; i < nLinF; i++) fore2D[i] = fore1D + i * nColF;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Associa um leitor a um arquivo já posicionado após o cabeçalho.
+ *
+ * O buffer só é alocado na primeira recarga, então leituras P6 não o usam.
+ */
+void iniciarLeitor(tpLeitor *leitor, FILE *arq)
+{
+    leitor->arq = arq;
+    leitor->buffer = NULL;
+    leitor->pos = leitor->tam = 0;
+    leitor->lidos = 0;
+    leitor->fim = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Libera o buffer de um leitor (o arquivo não é fechado).
+ *
+ * Os bytes lidos só entram em `bytesLidos` aqui, então leitores em threads
+ * diferentes não disputam o contador global.
+ */
+void liberarLeitor(tpLeitor *leitor)
+{
+    bytesLidos += leitor->lidos;
+    leitor->lidos = 0;
+
+    free(leitor->buffer);
+    leitor->buffer = NULL;
+    leitor->pos = leitor->tam = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Move o que resta no buffer para o início e completa com o arquivo.
+ */
+void recarregarLeitor(tpLeitor *leitor)
+{
+    size_t resto;
+
+    if (leitor->buffer == NULL){
+
+        leitor->buffer = (unsigned char *)malloc(TAM_BUFFER_LEITURA + 1);
+
+        if (leitor->buffer == NULL){
+
+            printf("Erro ao alocar.\n");
+            exit(1);
+        }
+    }
+
+    resto = leitor->tam - leitor->pos;
+    memmove(leitor->buffer, leitor->buffer + leitor->pos, resto);
+
+    leitor->pos = 0;
+    leitor->tam = resto;
+
+    if (!leitor->fim){
+
+        size_t lidos = fread(leitor->buffer + resto, 1, TAM_BUFFER_LEITURA - resto, leitor->arq);
+
+        leitor->lidos += lidos;
+        leitor->tam += lidos;
+        leitor->fim = leitor->tam < TAM_BUFFER_LEITURA;
+    }
+
+    leitor->buffer[leitor->tam] = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Copia `n` bytes do leitor: primeiro o que já está no buffer, depois do arquivo.
+ */
+void lerBytes(tpLeitor *leitor, void *destino, size_t n)
+{
+    size_t doBuffer = leitor->tam - leitor->pos;
+
+    if (doBuffer > n) doBuffer = n;
+
+    if (doBuffer > 0) memcpy(destino, leitor->buffer + leitor->pos, doBuffer);
+    leitor->pos += doBuffer;
+
+    if (fread((unsigned char *)destino + doBuffer, 1, n - doBuffer, leitor->arq) != n - doBuffer){
+
+        printf("Erro ao guardar imagens.\n");
+        exit(1);
+    }
+
+    leitor->lidos += n - doBuffer;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê o próximo valor de um P3. Convertido para `unsigned char`, dá o
+ * mesmo resultado de `fscanf("%hhu ")`.
+ *
+ * Aceita qualquer combinação de espaços e comentários `#` entre os valores.
+ * Antes de cada token são garantidos `RESERVA_LEITURA` bytes no buffer, então
+ * o laço de dígitos só testa o limite quando um número é mais longo que isso.
+ */
+unsigned int lerValorP3(tpLeitor *leitor)
+{
+    unsigned int valor = 0, digito;
+    int negativo = 0;
+    unsigned char *p;
+
+    while (1){
+
+        if (leitor->tam - leitor->pos < RESERVA_LEITURA && !leitor->fim) recarregarLeitor(leitor);
+
+        if (leitor->pos >= leitor->tam){
+
+            printf("Erro ao guardar imagens.\n");
+            exit(1);
+        }
+
+        p = leitor->buffer + leitor->pos;
+
+        if (*p == ' ' || (*p >= '\t' && *p <= '\r')) leitor->pos++;
+
+        else if (*p == '#'){
+
+            while (1){
+
+                while (leitor->pos < leitor->tam && leitor->buffer[leitor->pos] != '\n') leitor->pos++;
+
+                if (leitor->pos < leitor->tam || leitor->fim) break;
+
+                recarregarLeitor(leitor);
+            }
+        }
+
+        else break;
+    }
+
+    if (*p == '-' || *p == '+'){
+
+        negativo = *p == '-';
+        p++;
+    }
+
+    while (1){
+
+        while ((digito = (unsigned int)(*p - '0')) < 10){
+
+            valor = valor * 10 + digito;
+            p++;
+        }
+
+        leitor->pos = p - leitor->buffer;
+
+        if (leitor->pos < leitor->tam || leitor->fim) break;
+
+        recarregarLeitor(leitor);
+        p = leitor->buffer;
+    }
+
+    return negativo ? 0u - valor : valor;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê `n` valores de um P3 em `canais`, com `bytesCanal` bytes cada (1 ou 2).
+ *
+ * Os valores separados por espaço ou quebra de linha são convertidos num laço
+ * local; qualquer outro caso, inclusive um valor que passe do fim da janela
+ * de `RESERVA_LEITURA` bytes, passa por `lerValorP3()`.
+ */
+void lerCanaisP3(tpLeitor *leitor, void *canais, size_t n, int bytesCanal)
+{
+    unsigned char *canais8 = (unsigned char *)canais;
+    unsigned short *canais16 = (unsigned short *)canais;
+    size_t k = 0;
+
+    while (k < n){
+
+        unsigned char *p, *limite;
+
+        if (leitor->tam - leitor->pos < RESERVA_LEITURA && !leitor->fim) recarregarLeitor(leitor);
+
+        p = leitor->buffer + leitor->pos;
+        limite = leitor->buffer + leitor->tam - (leitor->fim ? 0 : RESERVA_LEITURA);
+
+        /* Caminho rápido: um espaço simples e dígitos, sem testes de limite. */
+        while (k < n && p < limite){
+
+            unsigned int valor = 0, digito;
+            unsigned char *inicio;
+
+            while (*p == ' ' || *p == '\n') p++;
+
+            if ((digito = (unsigned int)(*p - '0')) >= 10 || p >= limite) break;
+
+            inicio = p;
+
+            do{
+
+                valor = valor * 10 + digito;
+                p++;
+
+            } while ((digito = (unsigned int)(*p - '0')) < 10);
+
+            /* Um valor que passa da janela (zeros à esquerda) pode continuar
+               depois do fim do buffer: é relido inteiro por lerValorP3(). */
+            if (p > limite && !leitor->fim){
+
+                p = inicio;
+                break;
+            }
+
+            if (bytesCanal == 1) canais8[k++] = (unsigned char)valor;
+            else canais16[k++] = (unsigned short)valor;
+        }
+
+        leitor->pos = p - leitor->buffer;
+
+        /* Comentários, sinais, outros espaços e fim de buffer. */
+        if (k < n){
+
+            unsigned int valor = lerValorP3(leitor);
+
+            if (bytesCanal == 1) canais8[k++] = (unsigned char)valor;
+            else canais16[k++] = (unsigned short)valor;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê a próxima linha de `nCol` pixels de uma imagem P3 ou P6.
+ */
+void lerLinha(tpLeitor *leitor, const char *info, tpPixel *linha, size_t nCol)
+{
+    if (strcmp(info, "P6") == 0){
+
+        lerBytes(leitor, linha, sizeof(tpPixel) * nCol);
+        return;
+    }
+
+    lerCanaisP3(leitor, linha, 3 * nCol, 1);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão de `lerLinha()` para imagens de 16 bits por canal.
+ *
+ * No P6 de 16 bits cada canal ocupa dois bytes, o mais significativo primeiro,
+ * então os bytes são trocados para a ordem da máquina depois da leitura.
+ */
+void lerLinha16(tpLeitor *leitor, const char *info, tpPixel16 *linha, size_t nCol)
+{
+    if (strcmp(info, "P6") == 0){
+
+        unsigned char *bytes = (unsigned char *)linha;
+        unsigned short *canais = (unsigned short *)linha;
+
+        lerBytes(leitor, linha, sizeof(tpPixel16) * nCol);
+
+        for (size_t k = 0; k < 3 * nCol; k++) canais[k] = (unsigned short)(bytes[2 * k] << 8 | bytes[2 * k + 1]);
+
+        return;
+    }
+
+    lerCanaisP3(leitor, linha, 3 * nCol, 2);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Associa um escritor a um arquivo e monta a tabela de valores em texto.
+ */
+void iniciarEscritor(tpEscritor *escritor, FILE *arq)
+{
+    escritor->arq = arq;
+    escritor->pos = 0;
+    escritor->buffer = (char *)malloc(TAM_BUFFER_ESCRITA);
+
+    if (escritor->buffer == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    if (tamTexto[255] == 0){
+
+        for (int v = 0; v < 256; v++){
+
+            tamTexto[v] = (unsigned char)sprintf(textoValor[v], "%d", v);
+            textoValor[v][tamTexto[v]] = ' ';
+            tamTexto[v]++;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava no arquivo o que estiver acumulado no buffer do escritor.
+ */
+void descarregarEscritor(tpEscritor *escritor)
+{
+    if (escritor->pos > 0 && fwrite(escritor->buffer, 1, escritor->pos, escritor->arq) != escritor->pos){
+
+        printf("Erro ao gravar arquivo de saida.\n");
+        exit(1);
+    }
+
+    bytesGravados += escritor->pos;
+
+    escritor->pos = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Descarrega e libera o buffer de um escritor (o arquivo não é fechado).
+ */
+void liberarEscritor(tpEscritor *escritor)
+{
+    descarregarEscritor(escritor);
+    free(escritor->buffer);
+    escritor->buffer = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava uma linha de `nCol` pixels no formato de saída `infoS`.
+ *
+ * Em P3 cada canal é copiado da tabela `textoValor` (4 bytes fixos, avançando
+ * só o tamanho real), o que produz exatamente o texto de
+ * `fprintf("%hhu %hhu %hhu\n")`. O buffer vai para o arquivo em blocos de
+ * `TAM_BUFFER_ESCRITA`.
+ */
+void escreverLinha(tpEscritor *escritor, const tpPixel *linha, size_t nCol)
+{
+    if (strcmp(infoS, "P6") == 0){
+
+        size_t bytes = sizeof(tpPixel) * nCol;
+
+        if (escritor->pos + bytes > TAM_BUFFER_ESCRITA) descarregarEscritor(escritor);
+
+        if (bytes > TAM_BUFFER_ESCRITA){
+
+            if (fwrite(linha, 1, bytes, escritor->arq) != bytes){
+
+                printf("Erro ao gravar arquivo de saida.\n");
+                exit(1);
+            }
+
+            bytesGravados += bytes;
+
+            return;
+        }
+
+        memcpy(escritor->buffer + escritor->pos, linha, bytes);
+        escritor->pos += bytes;
+        return;
+    }
+
+    for (size_t j = 0; j < nCol; j++){
+
+        char *p;
+
+        if (escritor->pos + 3 * 4 > TAM_BUFFER_ESCRITA) descarregarEscritor(escritor);
+
+        p = escritor->buffer + escritor->pos;
+
+        memcpy(p, textoValor[linha[j].R], 4);
+        p += tamTexto[linha[j].R];
+        memcpy(p, textoValor[linha[j].G], 4);
+        p += tamTexto[linha[j].G];
+        memcpy(p, textoValor[linha[j].B], 4);
+        p += tamTexto[linha[j].B];
+        p[-1] = '\n';
+
+        escritor->pos = p - escritor->buffer;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão de `escreverLinha()` para imagens de 16 bits por canal.
+ *
+ * Em P6 cada canal é gravado com o byte mais significativo primeiro; em P3 os
+ * valores vão até 65535 e são convertidos dígito a dígito no próprio buffer.
+ */
+void escreverLinha16(tpEscritor *escritor, const tpPixel16 *linha, size_t nCol)
+{
+    const unsigned short *canais = (const unsigned short *)linha;
+    int p6 = strcmp(infoS, "P6") == 0;
+
+    for (size_t j = 0; j < nCol; j++){
+
+        char *p;
+
+        if (escritor->pos + 3 * 6 > TAM_BUFFER_ESCRITA) descarregarEscritor(escritor);
+
+        p = escritor->buffer + escritor->pos;
+
+        for (int c = 0; c < 3; c++){
+
+            unsigned int valor = canais[3 * j + c];
+
+            if (p6){
+
+                *p++ = (char)(valor >> 8);
+                *p++ = (char)(valor & 0xFF);
+            }
+
+            else{
+
+                char digitos[5];
+                int n = 0;
+
+                do{
+
+                    digitos[n++] = (char)('0' + valor % 10);
+                    valor /= 10;
+
+                } while (valor > 0);
+
+                while (n > 0) *p++ = digitos[--n];
+
+                *p++ = c < 2 ? ' ' : '\n';
+            }
+        }
+
+        escritor->pos = p - escritor->buffer;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava o cabeçalho da imagem de saída, com as dimensões do background.
+ */
+void escreverCabecalho(FILE *arq)
+{
+    int n = fprintf(arq, "%s\n%zu %zu\n%d\n", infoS, nColB, nLinB, maxValB);
+
+    if (n > 0) bytesGravados += n;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava uma imagem composta (cabeçalho e pixels) no formato `infoS`.
+ *
+ * Em P6 cada trecho de linhas contíguas na memória (um bloco) é gravado com
+ * uma única escrita.
+ */
+void gravarImagem(FILE *arq, tpPixel **img2D)
+{
+    tpEscritor escritor;
+
+    escreverCabecalho(arq);
+
+    if (strcmp(infoS, "P6") == 0){
+
+        for (size_t i = 0; i < nLinB; ){
+
+            size_t n = 1;
+
+            while (i + n < nLinB && img2D[i + n] == img2D[i] + n * nColB) n++;
+
+            if (fwrite(img2D[i], sizeof(tpPixel), nColB * n, arq) != nColB * n){
+
+                printf("Erro ao gravar arquivo de saida.\n");
+                exit(1);
+            }
+
+            bytesGravados += sizeof(tpPixel) * nColB * n;
+
+            i += n;
+        }
+
+        return;
+    }
+
+    iniciarEscritor(&escritor, arq);
+
+    for (size_t i = 0; i < nLinB; i++){
+
+        escreverLinha(&escritor, img2D[i], nColB);
+    }
+
+    liberarEscritor(&escritor);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava `n` bytes no arquivo de saída, contando-os em `bytesGravados`.
+ */
+void gravarBytes(FILE *arq, const void *dados, size_t n)
+{
+    if (n > 0 && fwrite(dados, 1, n, arq) != n){
+
+        printf("Erro ao gravar arquivo de saida.\n");
+        exit(1);
+    }
+
+    bytesGravados += n;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Monta as tabelas do CRC-32 e dos códigos Huffman fixos do deflate.
+ *
+ * Os códigos de literal/comprimento já ficam com os bits invertidos, pois o
+ * deflate grava os códigos Huffman a partir do bit mais significativo num
+ * fluxo que é preenchido a partir do menos significativo.
+ */
+void iniciarTabelasPNG()
+{
+    for (unsigned int n = 0; n < 256; n++){
+
+        unsigned int c = n;
+
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+
+        tabelaCRC[n] = c;
+    }
+
+    for (int v = 0; v < 288; v++){
+
+        unsigned int codigo, bits, invertido = 0;
+
+        if (v < 144){ codigo = 0x30 + v; bits = 8; }
+        else if (v < 256){ codigo = 0x190 + (v - 144); bits = 9; }
+        else if (v < 280){ codigo = v - 256; bits = 7; }
+        else{ codigo = 0xC0 + (v - 280); bits = 8; }
+
+        for (unsigned int b = 0; b < bits; b++) invertido |= ((codigo >> b) & 1) << (bits - 1 - b);
+
+        codigoLiteral[v] = (unsigned short)invertido;
+        bitsLiteral[v] = (unsigned char)bits;
+    }
+
+    for (int k = 0; k < 29; k++){
+
+        int fim = k + 1 < 29 ? baseComprimento[k + 1] : 259;
+
+        for (int c = baseComprimento[k]; c < fim; c++) indiceComprimento[c] = (unsigned char)k;
+    }
+
+    /* Distâncias até 256 são indexadas direto; as maiores, de 128 em 128. */
+    for (int k = 0; k < 30; k++){
+
+        int fim = k + 1 < 30 ? baseDistancia[k + 1] : JANELA_DEFLATE + 1;
+
+        for (int d = baseDistancia[k]; d < fim; d++){
+
+            if (d <= 256) indiceDistancia[d - 1] = (unsigned char)k;
+            else indiceDistancia[256 + ((d - 1) >> 7)] = (unsigned char)k;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Continua um CRC-32 (o do PNG) sobre mais `n` bytes.
+ *
+ * Começa com `0xFFFFFFFF` e o valor final é o complemento do retornado.
+ */
+unsigned int atualizarCRC(unsigned int crc, const unsigned char *dados, size_t n)
+{
+    for (size_t k = 0; k < n; k++) crc = tabelaCRC[(crc ^ dados[k]) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Adler-32 (o do zlib) de `n` bytes, adiando o módulo o máximo possível.
+ */
+unsigned int calcularAdler(const unsigned char *dados, size_t n)
+{
+    unsigned int a = 1, b = 0;
+
+    while (n > 0){
+
+        size_t trecho = n < 5552 ? n : 5552; /* maior trecho sem estourar 32 bits */
+
+        for (size_t k = 0; k < trecho; k++){
+
+            a += dados[k];
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+        dados += trecho;
+        n -= trecho;
+    }
+
+    return (b << 16) | a;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Adler-32 da concatenação de dois trechos, dados os Adler-32 de cada um.
+ *
+ * É o que permite calcular o Adler-32 de cada banda numa thread diferente.
+ */
+unsigned int combinarAdler(unsigned int adler1, unsigned int adler2, size_t tam2)
+{
+    unsigned int resto = (unsigned int)(tam2 % 65521);
+    unsigned int a = adler1 & 0xFFFF;
+    unsigned int b = (unsigned int)(((unsigned long long)resto * a) % 65521);
+
+    a += (adler2 & 0xFFFF) + 65521 - 1;
+    b += (adler1 >> 16) + (adler2 >> 16) + 65521 - resto;
+
+    if (a >= 65521) a -= 65521;
+    if (a >= 65521) a -= 65521;
+    if (b >= 2 * 65521) b -= 2 * 65521;
+    if (b >= 65521) b -= 65521;
+
+    return (b << 16) | a;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Filtra uma linha RGB do PNG, gravando o tipo de filtro e os bytes.
+ *
+ * Escolhe, entre os cinco filtros, o de menor soma dos valores absolutos (como
+ * bytes com sinal), a heurística recomendada pela especificação. `anterior` é
+ * NULL na primeira linha da imagem.
+ */
+void filtrarLinhaPNG(unsigned char *destino, const unsigned char *linha, const unsigned char *anterior, size_t bytes)
+{
+    unsigned long soma[5] = {0, 0, 0, 0, 0};
+    int melhor = 0;
+
+    for (size_t k = 0; k < bytes; k++){
+
+        int a = k >= 3 ? linha[k - 3] : 0;
+        int b = anterior != NULL ? anterior[k] : 0;
+        int c = anterior != NULL && k >= 3 ? anterior[k - 3] : 0;
+        int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        int previsto = (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+
+        soma[0] += abs((signed char)linha[k]);
+        soma[1] += abs((signed char)(linha[k] - a));
+        soma[2] += abs((signed char)(linha[k] - b));
+        soma[3] += abs((signed char)(linha[k] - ((a + b) >> 1)));
+        soma[4] += abs((signed char)(linha[k] - previsto));
+    }
+
+    for (int f = 1; f < 5; f++) if (soma[f] < soma[melhor]) melhor = f;
+
+    destino[0] = (unsigned char)melhor;
+    destino++;
+
+    for (size_t k = 0; k < bytes; k++){
+
+        int a = k >= 3 ? linha[k - 3] : 0;
+        int b = anterior != NULL ? anterior[k] : 0;
+        int c = anterior != NULL && k >= 3 ? anterior[k - 3] : 0;
+        int previsto = 0;
+
+        if (melhor == 1) previsto = a;
+        else if (melhor == 2) previsto = b;
+        else if (melhor == 3) previsto = (a + b) >> 1;
+        else if (melhor == 4){
+
+            int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+            previsto = (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+        }
+
+        destino[k] = (unsigned char)(linha[k] - previsto);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Acrescenta os `bits` menos significativos de `valor` ao fluxo.
+ *
+ * O acumulador vai para a saída de 32 em 32 bits; cada chamada traz no máximo
+ * 13 bits, então ele nunca passa de 45.
+ */
+void emitirBits(tpFluxoBits *fluxo, unsigned int valor, int bits)
+{
+    fluxo->acumulador |= (unsigned long long)valor << fluxo->nBits;
+    fluxo->nBits += bits;
+
+    if (fluxo->nBits >= 32){
+
+        unsigned char *s = fluxo->saida + fluxo->tam;
+
+        s[0] = (unsigned char)fluxo->acumulador;
+        s[1] = (unsigned char)(fluxo->acumulador >> 8);
+        s[2] = (unsigned char)(fluxo->acumulador >> 16);
+        s[3] = (unsigned char)(fluxo->acumulador >> 24);
+
+        fluxo->tam += 4;
+        fluxo->acumulador >>= 32;
+        fluxo->nBits -= 32;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Comprime `n` bytes num bloco deflate com códigos Huffman fixos.
+ *
+ * O LZ77 é guloso, com um candidato por hash de 3 bytes (`cabecas`, de
+ * `1 << HASH_PNG` posições) e só dentro destes `n` bytes, então bandas
+ * diferentes são comprimidas de forma independente. O bloco não é o último e
+ * termina com um bloco armazenado vazio, que alinha a saída em byte: os blocos
+ * das bandas podem ser simplesmente concatenados. Se a compressão não ganhar
+ * dos blocos armazenados (ruído, por exemplo), os bytes são regravados sem
+ * compressão. `saida` precisa de `n + n / 8 + 64` bytes.
+ */
+size_t comprimirDeflate(unsigned char *saida, const unsigned char *dados, size_t n, int *cabecas)
+{
+    tpFluxoBits fluxo = {saida, 0, 2, 3}; /* BFINAL = 0, BTYPE = 01 */
+    size_t i = 0;
+
+    for (int k = 0; k < (1 << HASH_PNG); k++) cabecas[k] = -1;
+
+    while (i < n){
+
+        size_t melhor = 0, distancia = 0;
+
+        if (i + 3 <= n){
+
+            unsigned int h = ((dados[i] << 10) ^ (dados[i + 1] << 5) ^ dados[i + 2]) & ((1 << HASH_PNG) - 1);
+            int candidato = cabecas[h];
+
+            cabecas[h] = (int)i;
+
+            if (candidato >= 0 && i - candidato <= JANELA_DEFLATE){
+
+                size_t limite = n - i < 258 ? n - i : 258;
+                const unsigned char *a = dados + candidato, *b = dados + i;
+
+                while (melhor < limite && a[melhor] == b[melhor]) melhor++;
+
+                distancia = i - candidato;
+            }
+        }
+
+        if (melhor >= 3){
+
+            int k = indiceComprimento[melhor];
+            int d = indiceDistancia[distancia <= 256 ? distancia - 1 : 256 + ((distancia - 1) >> 7)];
+
+            emitirBits(&fluxo, codigoLiteral[257 + k], bitsLiteral[257 + k]);
+            emitirBits(&fluxo, melhor - baseComprimento[k], extraComprimento[k]);
+
+            /* Códigos de distância fixos: 5 bits, também invertidos. */
+            emitirBits(&fluxo, ((d & 1) << 4) | ((d & 2) << 2) | (d & 4) | ((d & 8) >> 2) | ((d & 16) >> 4), 5);
+            emitirBits(&fluxo, distancia - baseDistancia[d], extraDistancia[d]);
+
+            for (size_t k2 = i + 1; k2 < i + melhor && k2 + 3 <= n; k2++){
+
+                cabecas[((dados[k2] << 10) ^ (dados[k2 + 1] << 5) ^ dados[k2 + 2]) & ((1 << HASH_PNG) - 1)] = (int)k2;
+            }
+
+            i += melhor;
+        }
+
+        else{
+
+            emitirBits(&fluxo, codigoLiteral[dados[i]], bitsLiteral[dados[i]]);
+            i++;
+        }
+    }
+
+    emitirBits(&fluxo, codigoLiteral[256], bitsLiteral[256]);
+    emitirBits(&fluxo, 0, 3); /* bloco armazenado vazio: BFINAL = 0, BTYPE = 00 */
+
+    while (fluxo.nBits > 0){
+
+        saida[fluxo.tam++] = (unsigned char)fluxo.acumulador;
+        fluxo.acumulador >>= 8;
+        fluxo.nBits -= 8;
+    }
+
+    saida[fluxo.tam++] = 0x00;
+    saida[fluxo.tam++] = 0x00;
+    saida[fluxo.tam++] = 0xFF;
+    saida[fluxo.tam++] = 0xFF;
+
+    if (fluxo.tam <= n + 5 * (n / 65535 + 1)) return fluxo.tam;
+
+    /* Blocos armazenados de até 65535 bytes: BFINAL = 0, BTYPE = 00, LEN e ~LEN. */
+    fluxo.tam = 0;
+
+    for (size_t k = 0; k < n; k += 65535){
+
+        unsigned int tam = n - k < 65535 ? (unsigned int)(n - k) : 65535;
+
+        saida[fluxo.tam++] = 0x00;
+        saida[fluxo.tam++] = (unsigned char)tam;
+        saida[fluxo.tam++] = (unsigned char)(tam >> 8);
+        saida[fluxo.tam++] = (unsigned char)~tam;
+        saida[fluxo.tam++] = (unsigned char)(~tam >> 8);
+        memcpy(saida + fluxo.tam, dados + k, tam);
+        fluxo.tam += tam;
+    }
+
+    return fluxo.tam;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Filtra e comprime uma banda de `linhasBandaPNG` linhas de `img2D`.
+ *
+ * Além do bloco deflate, guarda o Adler-32 dos bytes filtrados e o CRC do
+ * chunk IDAT que vai contê-lo, para que a gravação seja só sequencial.
+ */
+void codificarBandaPNG(int banda, void *arg)
+{
+    tpPixel **img2D = (tpPixel **)arg;
+    tpBandaPNG *b = &bandasPNG[banda];
+    size_t ini = (size_t)banda * linhasBandaPNG;
+    size_t fim = ini + linhasBandaPNG < nLinB ? ini + linhasBandaPNG : nLinB;
+    size_t bytesLinha = sizeof(tpPixel) * nColB;
+    size_t n = (fim - ini) * (1 + bytesLinha);
+    unsigned char *filtrado = (unsigned char *)malloc(n);
+    int *cabecas = (int *)malloc(sizeof(int) << HASH_PNG);
+
+    b->dados = (unsigned char *)malloc(n + n / 8 + 64);
+
+    if (filtrado == NULL || cabecas == NULL || b->dados == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    for (size_t i = ini; i < fim; i++){
+
+        filtrarLinhaPNG(filtrado + (i - ini) * (1 + bytesLinha), (const unsigned char *)img2D[i],
+                        i > 0 ? (const unsigned char *)img2D[i - 1] : NULL, bytesLinha);
+    }
+
+    b->bytesFiltrados = n;
+    b->adler = calcularAdler(filtrado, n);
+    b->tam = comprimirDeflate(b->dados, filtrado, n, cabecas);
+    b->crc = ~atualizarCRC(atualizarCRC(0xFFFFFFFFu, (const unsigned char *)"IDAT", 4), b->dados, b->tam);
+
+    free(filtrado);
+    free(cabecas);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava um chunk PNG pequeno (tamanho, tipo, dados e CRC).
+ */
+void escreverChunkPNG(FILE *arq, const char *tipo, const unsigned char *dados, size_t n)
+{
+    unsigned char cabecalho[8] = {(unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n,
+                                  (unsigned char)tipo[0], (unsigned char)tipo[1], (unsigned char)tipo[2], (unsigned char)tipo[3]};
+    unsigned int crc = ~atualizarCRC(atualizarCRC(0xFFFFFFFFu, cabecalho + 4, 4), dados, n);
+    unsigned char final[4] = {(unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc};
+
+    gravarBytes(arq, cabecalho, 8);
+    gravarBytes(arq, dados, n);
+    gravarBytes(arq, final, 4);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava uma imagem composta em PNG RGB de 8 bits, sem depender do zlib.
+ *
+ * A imagem é cortada em bandas de cerca de `BYTES_BANDA_PNG` bytes que o pool
+ * filtra e comprime em paralelo (`codificarBandaPNG()`); cada banda vira um
+ * chunk IDAT. O primeiro IDAT leva só o cabeçalho zlib e o último o bloco
+ * deflate final e o Adler-32 de tudo, combinado a partir dos de cada banda.
+ */
+void gravarPNG(FILE *arq, tpPixel **img2D)
+{
+    static const unsigned char assinatura[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    static const unsigned char cabecalhoZlib[2] = {0x78, 0x01};
+    size_t bytesLinha = sizeof(tpPixel) * nColB;
+    unsigned char ihdr[13] = {(unsigned char)(nColB >> 24), (unsigned char)(nColB >> 16), (unsigned char)(nColB >> 8), (unsigned char)nColB,
+                              (unsigned char)(nLinB >> 24), (unsigned char)(nLinB >> 16), (unsigned char)(nLinB >> 8), (unsigned char)nLinB,
+                              8, 2, 0, 0, 0};
+    unsigned char final[9] = {0x01, 0x00, 0x00, 0xFF, 0xFF}; /* bloco armazenado vazio com BFINAL = 1 */
+    unsigned int adler = 1;
+    int nBandas;
+
+    iniciarTabelasPNG();
+
+    linhasBandaPNG = BYTES_BANDA_PNG / (1 + bytesLinha);
+    if (linhasBandaPNG == 0) linhasBandaPNG = 1;
+
+    nBandas = (int)((nLinB + linhasBandaPNG - 1) / linhasBandaPNG);
+    bandasPNG = (tpBandaPNG *)calloc(nBandas, sizeof(tpBandaPNG));
+
+    if (bandasPNG == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    executarBandas(codificarBandaPNG, img2D, nBandas);
+
+    gravarBytes(arq, assinatura, 8);
+    escreverChunkPNG(arq, "IHDR", ihdr, 13);
+    escreverChunkPNG(arq, "IDAT", cabecalhoZlib, 2);
+
+    for (int k = 0; k < nBandas; k++){
+
+        tpBandaPNG *b = &bandasPNG[k];
+        unsigned char moldura[8] = {(unsigned char)(b->tam >> 24), (unsigned char)(b->tam >> 16), (unsigned char)(b->tam >> 8), (unsigned char)b->tam,
+                                    'I', 'D', 'A', 'T'};
+        unsigned char crc[4] = {(unsigned char)(b->crc >> 24), (unsigned char)(b->crc >> 16), (unsigned char)(b->crc >> 8), (unsigned char)b->crc};
+
+        gravarBytes(arq, moldura, 8);
+        gravarBytes(arq, b->dados, b->tam);
+        gravarBytes(arq, crc, 4);
+
+        adler = combinarAdler(adler, b->adler, b->bytesFiltrados);
+        free(b->dados);
+    }
+
+    free(bandasPNG);
+    bandasPNG = NULL;
+
+    final[5] = (unsigned char)(adler >> 24);
+    final[6] = (unsigned char)(adler >> 16);
+    final[7] = (unsigned char)(adler >> 8);
+    final[8] = (unsigned char)adler;
+
+    escreverChunkPNG(arq, "IDAT", final, 9);
+    escreverChunkPNG(arq, "IEND", NULL, 0);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava uma imagem composta no formato QOI (RGB), pelo escritor com buffer.
+ *
+ * O QOI codifica cada pixel em relação ao anterior e a uma tabela de 64 cores
+ * vistas, então é sequencial por natureza; ainda assim custa uma passada
+ * simples sobre os pixels e fica bem menor que o P6.
+ */
+void gravarQOI(FILE *arq, tpPixel **img2D)
+{
+    tpEscritor escritor;
+    tpPixel vistos[64], anterior = {0, 0, 0};
+    unsigned char cabecalho[14] = {'q', 'o', 'i', 'f',
+                                   (unsigned char)(nColB >> 24), (unsigned char)(nColB >> 16), (unsigned char)(nColB >> 8), (unsigned char)nColB,
+                                   (unsigned char)(nLinB >> 24), (unsigned char)(nLinB >> 16), (unsigned char)(nLinB >> 8), (unsigned char)nLinB,
+                                   3, 0};
+    static const unsigned char final[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    int repeticao = 0;
+
+    memset(vistos, 0, sizeof(vistos));
+
+    gravarBytes(arq, cabecalho, 14);
+    iniciarEscritor(&escritor, arq);
+
+    for (size_t i = 0; i < nLinB; i++){
+
+        const tpPixel *linha = img2D[i];
+
+        for (size_t j = 0; j < nColB; j++){
+
+            tpPixel p = linha[j];
+            unsigned char *s;
+
+            if (escritor.pos + 5 > TAM_BUFFER_ESCRITA) descarregarEscritor(&escritor);
+
+            s = (unsigned char *)escritor.buffer + escritor.pos;
+
+            if (p.R == anterior.R && p.G == anterior.G && p.B == anterior.B){
+
+                if (++repeticao == 62){
+
+                    *s++ = (unsigned char)(0xC0 | (repeticao - 1));
+                    repeticao = 0;
+                }
+            }
+
+            else{
+
+                /* O alfa (255) entra no hash como no formato RGBA: 255 * 11 = 2805. */
+                int indice = (p.R * 3 + p.G * 5 + p.B * 7 + 2805) % 64;
+
+                if (repeticao > 0){
+
+                    *s++ = (unsigned char)(0xC0 | (repeticao - 1));
+                    repeticao = 0;
+                }
+
+                if (vistos[indice].R == p.R && vistos[indice].G == p.G && vistos[indice].B == p.B) *s++ = (unsigned char)indice;
+
+                else{
+
+                    signed char dR = (signed char)(p.R - anterior.R);
+                    signed char dG = (signed char)(p.G - anterior.G);
+                    signed char dB = (signed char)(p.B - anterior.B);
+                    signed char dRG = (signed char)(dR - dG), dBG = (signed char)(dB - dG);
+
+                    vistos[indice] = p;
+
+                    if (dR >= -2 && dR <= 1 && dG >= -2 && dG <= 1 && dB >= -2 && dB <= 1){
+
+                        *s++ = (unsigned char)(0x40 | (dR + 2) << 4 | (dG + 2) << 2 | (dB + 2));
+                    }
+
+                    else if (dG >= -32 && dG <= 31 && dRG >= -8 && dRG <= 7 && dBG >= -8 && dBG <= 7){
+
+                        *s++ = (unsigned char)(0x80 | (dG + 32));
+                        *s++ = (unsigned char)((dRG + 8) << 4 | (dBG + 8));
+                    }
+
+                    else{
+
+                        *s++ = 0xFE;
+                        *s++ = p.R;
+                        *s++ = p.G;
+                        *s++ = p.B;
+                    }
+                }
+
+                anterior = p;
+            }
+
+            escritor.pos = (char *)s - escritor.buffer;
+        }
+    }
+
+    if (repeticao > 0) escritor.buffer[escritor.pos++] = (char)(0xC0 | (repeticao - 1));
+
+    liberarEscritor(&escritor);
+    gravarBytes(arq, final, 8);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê os pixels de uma imagem já posicionada após o cabeçalho.
+ *
+ * Em P6 cada trecho de linhas contíguas na memória (um bloco) é preenchido com
+ * uma única leitura, pois o layout de `tpPixel` coincide com o do arquivo. Em
+ * P3 o texto passa pelo leitor com buffer, linha a linha.
+ */
+void lerPixels(tpLeitor *leitor, const char *info, tpPixel **img2D, size_t nLin, size_t nCol)
+{
+    if (strcmp(info, "P6") == 0){
+
+        for (size_t i = 0; i < nLin; ){
+
+            size_t n = 1;
+
+            while (i + n < nLin && img2D[i + n] == img2D[i] + n * nCol) n++;
+
+            lerBytes(leitor, img2D[i], sizeof(tpPixel) * nCol * n);
+            i += n;
+        }
+
+        return;
+    }
+
+    for (size_t i = 0; i < nLin; i++){
+
+        lerLinha(leitor, info, img2D[i], nCol);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê os dados de pixel dos arquivos e os guarda na memória alocada.
+ */
+void guardaImagens()
+{
+    iniciarLeitor(&leitorBack, arqBack);
+    iniciarLeitor(&leitorFore, arqFore);
+
+    if (mapaBack == NULL) lerPixels(&leitorBack, infoB, back2D, nLinB, nColB);
+    if (mapaFore == NULL) lerPixels(&leitorFore, infoF, fore2D, nLinF, nColF);
+
+    liberarLeitor(&leitorBack);
+    liberarLeitor(&leitorFore);
+
+    if (fclose(arqBack) != 0 || fclose(arqFore) != 0){
+
+        printf("Erro ao guardar imagens.\n");
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê a placa limpa de `--plate`, que deve ter o tamanho do foreground.
+ *
+ * Fica em `placa2D`, na mesma grade de linhas do foreground, então a linha
+ * da placa de cada pixel composto é achada com os mesmos desvios.
+ */
+void carregarPlaca()
+{
+    char infoP[4];
+    size_t nColP, nLinP, maxP;
+    tpLeitor leitor;
+
+    if (fscanf(arqPlaca, "%3s", infoP) != 1 || (strcmp(infoP, "P3") != 0 && strcmp(infoP, "P6") != 0)){
+
+        printf("A placa limpa deve ter o formato P3 ou P6.\n");
+        exit(1);
+    }
+
+    nColP = lerValorCabecalho(arqPlaca);
+    nLinP = lerValorCabecalho(arqPlaca);
+    maxP = lerValorCabecalho(arqPlaca);
+
+    if (nColP != nColF || nLinP != nLinF || (int)maxP != maxValF){
+
+        printf("A placa limpa deve ter as dimensoes e a intensidade maxima do foreground.\n");
+        exit(1);
+    }
+
+    bytesLidos += (size_t)ftell(arqPlaca);
+
+    nLinPlaca = nLinP;
+    nColPlaca = nColP;
+    placa2D = reservarImagem(&blocosPlaca, nLinF, nColF);
+
+    iniciarLeitor(&leitor, arqPlaca);
+    lerPixels(&leitor, infoP, placa2D, nLinF, nColF);
+    liberarLeitor(&leitor);
+
+    if (fclose(arqPlaca) != 0){
+
+        printf("Erro ao guardar imagens.\n");
+        exit(1);
+    }
+
+    arqPlaca = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Detecta a cor chave e sugere a tolerância a partir de uma amostra do foreground.
+ *
+ * Só uma grade de no máximo `AMOSTRAS_AUTO` pixels da região usada do
+ * foreground é lida, então o custo não cresce com a resolução. As amostras
+ * vão para um histograma RGB de 5 bits por canal. A chave é a média das
+ * amostras em volta (vizinhança 3x3x3) da célula mais cheia entre as
+ * saturadas, ou entre todas se nenhuma for saturada.
+ *
+ * Para a tolerância, o limiar de Otsu do histograma das distâncias até a
+ * chave separa o grupo compacto do fundo do resto da imagem; dentro dele, a
+ * tolerância é a primeira distância depois do pico em que o histograma cai
+ * abaixo de `QUEDA_AUTO` do pico, ou seja, onde o grupo da chave acaba.
+ */
+void detectarChave()
+{
+    size_t nLin = linFim - linIni, nCol = colFim - colIni;
+    size_t passo = 1, amostras = 0;
+    unsigned int *hist = (unsigned int *)calloc(1 << 15, sizeof(unsigned int));
+    unsigned int histDist[442] = {0};
+    unsigned long long soma[3] = {0, 0, 0}, contados = 0;
+    int melhor = -1, melhorSat = -1, limiar = 0;
+    double inicio = tempoAtual();
+    tpChave k;
+
+    if (hist == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    if (nLin == 0 || nCol == 0){
+
+        free(hist);
+        return;
+    }
+
+    while ((nLin + passo - 1) / passo * ((nCol + passo - 1) / passo) > AMOSTRAS_AUTO) passo++;
+
+    for (size_t i = 0; i < nLin; i += passo){
+
+        const tpPixel *linha = fore2D[i + linIni + desvioLin] + colIni + desvioCol;
+
+        for (size_t j = 0; j < nCol; j += passo){
+
+            hist[(linha[j].R >> 3) << 10 | (linha[j].G >> 3) << 5 | (linha[j].B >> 3)]++;
+            amostras++;
+        }
+    }
+
+    for (int c = 0; c < 1 << 15; c++){
+
+        int r = (c >> 10) * 8 + 4, g = ((c >> 5) & 31) * 8 + 4, b = (c & 31) * 8 + 4;
+        int maior = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int menor = r < g ? (r < b ? r : b) : (g < b ? g : b);
+
+        if (hist[c] == 0) continue;
+
+        if (maior - menor >= SATURACAO_AUTO){
+
+            if (melhorSat < 0 || hist[c] > hist[melhorSat]) melhorSat = c;
+        }
+
+        if (melhor < 0 || hist[c] > hist[melhor]) melhor = c;
+    }
+
+    if (melhorSat >= 0) melhor = melhorSat;
+
+    /* Segunda passada pela mesma grade: média das amostras vizinhas da célula escolhida. */
+    for (size_t i = 0; i < nLin; i += passo){
+
+        const tpPixel *linha = fore2D[i + linIni + desvioLin] + colIni + desvioCol;
+
+        for (size_t j = 0; j < nCol; j += passo){
+
+            int dr = (linha[j].R >> 3) - (melhor >> 10);
+            int dg = (linha[j].G >> 3) - ((melhor >> 5) & 31);
+            int db = (linha[j].B >> 3) - (melhor & 31);
+
+            if (dr >= -1 && dr <= 1 && dg >= -1 && dg <= 1 && db >= -1 && db <= 1){
+
+                soma[0] += linha[j].R;
+                soma[1] += linha[j].G;
+                soma[2] += linha[j].B;
+                contados++;
+            }
+        }
+    }
+
+    chaveR = (unsigned char)((soma[0] + contados / 2) / contados);
+    chaveG = (unsigned char)((soma[1] + contados / 2) / contados);
+    chaveB = (unsigned char)((soma[2] + contados / 2) / contados);
+
+    k.R = chaveR;
+    k.G = chaveG;
+    k.B = chaveB;
+    k.Cb = calcularCb(chaveR, chaveG, chaveB);
+    k.Cr = calcularCr(chaveR, chaveG, chaveB);
+    k.espaco = espacoCor;
+
+    for (size_t i = 0; i < nLin; i += passo){
+
+        const tpPixel *linha = fore2D[i + linIni + desvioLin] + colIni + desvioCol;
+
+        for (size_t j = 0; j < nCol; j += passo){
+
+            int d = (int)(sqrt((double)distanciaChave(&linha[j], &k)) + 0.5);
+
+            histDist[d > 441 ? 441 : d]++;
+        }
+    }
+
+    /* Otsu: o limiar que maximiza a variância entre as classes "perto" e "longe" da chave. */
+    {
+        double total = 0.0, somaTotal = 0.0, peso0 = 0.0, soma0 = 0.0, melhorVar = -1.0;
+
+        for (int d = 0; d < 442; d++){
+
+            total += histDist[d];
+            somaTotal += (double)d * histDist[d];
+        }
+
+        for (int t = 0; t < 441; t++){
+
+            double peso1, media0, media1, var;
+
+            peso0 += histDist[t];
+            soma0 += (double)t * histDist[t];
+            peso1 = total - peso0;
+
+            if (peso0 == 0 || peso1 == 0) continue;
+
+            media0 = soma0 / peso0;
+            media1 = (somaTotal - soma0) / peso1;
+            var = peso0 * peso1 * (media0 - media1) * (media0 - media1);
+
+            if (var > melhorVar){
+
+                melhorVar = var;
+                limiar = t;
+            }
+        }
+    }
+
+    {
+        int pico = 0, fimGrupo;
+
+        for (int d = 1; d <= limiar; d++) if (histDist[d] > histDist[pico]) pico = d;
+
+        fimGrupo = pico;
+        while (fimGrupo < limiar && histDist[fimGrupo] * QUEDA_AUTO >= histDist[pico]) fimGrupo++;
+
+        tolerancia = fimGrupo + 1;
+    }
+
+    tolInterna = tolerancia;
+    if (tolExterna < tolInterna) tolExterna = tolInterna;
+
+    free(hist);
+
+    fprintf(stderr, "Chave automatica: %d %d %d, tolerancia %d (%zu amostras, %.2f ms)\n",
+            chaveR, chaveG, chaveB, tolerancia, amostras, (tempoAtual() - inicio) * 1e3);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Converte o nível de `--simd` para `nivelChave`, repassado a `compor()`.
+ *
+ * A escolha dos kernels fica na biblioteca, que consulta o processador uma vez
+ * por processo; um nível que ele não suporta é rebaixado para o melhor
+ * disponível, para que o mesmo executável funcione em qualquer máquina.
+ */
+void selecionarKernel()
+{
+    if (nivelSimd == NULL) return;
+
+    if (strcmp(nivelSimd, "escalar") == 0) nivelChave = CHROMA_SIMD_ESCALAR;
+    else if (strcmp(nivelSimd, "ssse3") == 0) nivelChave = CHROMA_SIMD_SSSE3;
+    else if (strcmp(nivelSimd, "avx2") == 0) nivelChave = CHROMA_SIMD_AVX2;
+    else{
+
+        printf("Nivel SIMD invalido: use escalar, ssse3 ou avx2.\n");
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Retorna um instante em segundos, de um relógio monotônico.
+ */
+double tempoAtual()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Tempo de CPU do processo (todas as threads), em segundos.
+ */
+double tempoCPU()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Marca o início de um trecho da fase `fase` (só com `--stats`).
+ */
+void iniciarFase(int fase)
+{
+    if (!usarStats) return;
+
+    inicioParede[fase] = tempoAtual();
+    inicioCPU[fase] = tempoCPU();
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Soma ao total da fase o trecho aberto por `iniciarFase()`.
+ *
+ * Uma fase pode ser aberta e fechada várias vezes (em `--stream`, uma vez por
+ * linha) e os trechos se acumulam.
+ */
+void encerrarFase(int fase)
+{
+    if (!usarStats) return;
+
+    paredeFase[fase] += tempoAtual() - inicioParede[fase];
+    cpuFase[fase] += tempoCPU() - inicioCPU[fase];
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Laço das threads do pool: espera uma nova tarefa e consome bandas.
+ *
+ * Cada tarefa é identificada por `geracaoPool`; as bandas são retiradas de um
+ * contador compartilhado até acabarem.
+ */
+void *trabalhadorPool(void *arg)
+{
+    int geracaoVista = 0;
+    (void)arg;
+
+    pthread_mutex_lock(&mutexPool);
+
+    while (1){
+
+        while (!fimPool && geracaoPool == geracaoVista) pthread_cond_wait(&condTarefa, &mutexPool);
+
+        if (fimPool) break;
+
+        geracaoVista = geracaoPool;
+
+        while (proximaBanda < totalBandas){
+
+            int banda = proximaBanda++;
+
+            pthread_mutex_unlock(&mutexPool);
+            tarefaPool(banda, argPool);
+            pthread_mutex_lock(&mutexPool);
+
+            if (--bandasPendentes == 0) pthread_cond_signal(&condFim);
+        }
+    }
+
+    pthread_mutex_unlock(&mutexPool);
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Cria as `numThreads - 1` threads auxiliares (a principal também trabalha).
+ */
+void iniciarPool()
+{
+    if (threadsPool != NULL || numThreads <= 1) return;
+
+    threadsPool = (pthread_t *)malloc(sizeof(pthread_t) * (numThreads - 1));
+
+    if (threadsPool == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    fimPool = 0;
+
+    for (int t = 0; t < numThreads - 1; t++){
+
+        if (pthread_create(&threadsPool[t], NULL, trabalhadorPool, NULL) != 0){
+
+            printf("Erro ao criar threads.\n");
+            exit(1);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Executa `tarefa` para as bandas 0..nBandas-1 e espera todas terminarem.
+ */
+void executarBandas(void (*tarefa)(int banda, void *arg), void *arg, int nBandas)
+{
+    if (threadsPool == NULL){
+
+        for (int banda = 0; banda < nBandas; banda++) tarefa(banda, arg);
+        return;
+    }
+
+    pthread_mutex_lock(&mutexPool);
+
+    tarefaPool = tarefa;
+    argPool = arg;
+    proximaBanda = 0;
+    totalBandas = nBandas;
+    bandasPendentes = nBandas;
+    geracaoPool++;
+
+    pthread_cond_broadcast(&condTarefa);
+
+    while (proximaBanda < totalBandas){
+
+        int banda = proximaBanda++;
+
+        pthread_mutex_unlock(&mutexPool);
+        tarefa(banda, arg);
+        pthread_mutex_lock(&mutexPool);
+
+        bandasPendentes--;
+    }
+
+    while (bandasPendentes > 0) pthread_cond_wait(&condFim, &mutexPool);
+
+    pthread_mutex_unlock(&mutexPool);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Encerra e aguarda as threads do pool.
+ */
+void encerrarPool()
+{
+    if (threadsPool == NULL) return;
+
+    pthread_mutex_lock(&mutexPool);
+    fimPool = 1;
+    pthread_cond_broadcast(&condTarefa);
+    pthread_mutex_unlock(&mutexPool);
+
+    for (int t = 0; t < numThreads - 1; t++) pthread_join(threadsPool[t], NULL);
+
+    free(threadsPool);
+    threadsPool = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Descreve para `compor()` uma imagem guardada como tabela de linhas.
+ */
+tpImagem imagemLinhas(tpPixel **linhas, size_t nLin, size_t nCol)
+{
+    tpImagem img;
+
+    memset(&img, 0, sizeof(img));
+    img.linhas = linhas;
+    img.nLin = nLin;
+    img.nCol = nCol;
+
+    return img;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Versão de `imagemLinhas()` para imagens de 16 bits.
+ */
+tpImagem imagemLinhas16(tpPixel16 **linhas, size_t nLin, size_t nCol)
+{
+    tpImagem img;
+
+    memset(&img, 0, sizeof(img));
+    img.linhas16 = linhas;
+    img.nLin = nLin;
+    img.nCol = nCol;
+
+    return img;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Descreve para `compor()` uma imagem de linhas contíguas, sem preenchimento.
+ */
+tpImagem imagemContigua(tpPixel *pixels, size_t nLin, size_t nCol)
+{
+    tpImagem img;
+
+    memset(&img, 0, sizeof(img));
+    img.pixels = pixels;
+    img.nLin = nLin;
+    img.nCol = nCol;
+    img.passo = nCol;
+
+    return img;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Monta as opções de `compor()` a partir da linha de comando.
+ *
+ * A placa de `--plate` fica com quem chama, que conhece a imagem. Com
+ * `--stats`, as contagens vão para `relatorio`, que também recebe o nome do
+ * kernel usado.
+ */
+void montarOpcoes(tpOpcoesChave *opcoes, tpRelatorio *relatorio)
+{
+    memset(opcoes, 0, sizeof(*opcoes));
+
+    opcoes->espaco = espacoCor;
+    opcoes->despill = usarDespill;
+    opcoes->diferenca = usarDiferenca;
+    opcoes->simd = nivelChave;
+    opcoes->suave = usarSuave;
+    opcoes->tolExterna = tolExterna;
+    opcoes->raioErosao = raioErosao;
+    opcoes->raioDilatacao = raioDilatacao;
+    opcoes->raioCaixa = raioCaixa;
+    opcoes->raioGauss = raioGauss;
+    opcoes->planar = usarPlanar;
+    opcoes->chave16.R = chave16R;
+    opcoes->chave16.G = chave16G;
+    opcoes->chave16.B = chave16B;
+    opcoes->deslocX = deslocX;
+    opcoes->deslocY = deslocY;
+    opcoes->recortar = 1;
+    opcoes->recorteX = recorteX;
+    opcoes->recorteY = recorteY;
+    opcoes->recorteL = recorteL;
+    opcoes->recorteA = recorteA;
+    opcoes->threads = numThreads;
+    opcoes->contar = usarStats;
+    opcoes->relatorio = relatorio;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Opções de `compor()` para uma faixa de linhas de `--stream` e `--pipeline`.
+ *
+ * Nesses modos as linhas do foreground já chegam alinhadas às do fundo, então
+ * só a posição horizontal vem da linha de comando, e a faixa é composta pela
+ * thread que a recebeu.
+ */
+void montarOpcoesFaixa(tpOpcoesChave *opcoes, tpRelatorio *relatorio)
+{
+    montarOpcoes(opcoes, relatorio);
+
+    opcoes->deslocY = 0;
+    opcoes->recorteY = 0;
+    opcoes->recorteA = -1;
+    opcoes->threads = 1;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Chama `compor()` com a chave da linha de comando e encerra em caso de erro.
+ *
+ * Com `--stats`, soma as contagens de `relatorio` e passa o tempo da contagem,
+ * feita dentro de `compor()`, da fase de composição para a de contagem (o
+ * tempo de CPU dela fica na composição).
+ */
+void comporImagem(const tpImagem *fore, const tpImagem *back, tpImagem *saida, const tpOpcoesChave *opcoes)
+{
+    tpRelatorio *relatorio = opcoes->relatorio;
+    tpPixel chave;
+    int retorno;
+
+    chave.R = chaveR;
+    chave.G = chaveG;
+    chave.B = chaveB;
+
+    retorno = compor(fore, back, chave, tolInterna, saida, opcoes);
+
+    if (retorno == CHROMA_ERRO_MEMORIA){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    if (retorno != CHROMA_OK){
+
+        printf("Erro na composicao.\n");
+        exit(1);
+    }
+
+    if (relatorio == NULL) return;
+
+    nomeKernel = relatorio->kernel;
+
+    if (opcoes->contar){
+
+        contFundo += relatorio->fundo;
+        contFrente += relatorio->frente;
+        contBorda += relatorio->borda;
+        paredeFase[FASE_COMPOSICAO] -= relatorio->tempoContagem;
+        paredeFase[FASE_CONTAGEM] += relatorio->tempoContagem;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Imprime em stdout a linha JSON de `--stats`.
+ */
+void imprimirEstatisticas(const char *modo)
+{
+    printf("{\"mode\":\"%s\",\"space\":\"%s\",\"width\":%zu,\"height\":%zu,\"maxval\":%d,\"threads\":%d,\"kernel\":\"%s\",\"key\":[%d,%d,%d],\"tolerance\":%d,\"phases\":{",
+           modo, espacoCor == ESPACO_CBCR ? "cbcr" : "rgb", nColB, nLinB, maxValB, numThreads, nomeKernel,
+           maxValB > 255 ? chave16R : chaveR, maxValB > 255 ? chave16G : chaveG, maxValB > 255 ? chave16B : chaveB, tolInterna);
+
+    for (int f = 0; f < NUM_FASES; f++){
+
+        printf("%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f}", f > 0 ? "," : "", nomesFases[f], paredeFase[f], cpuFase[f]);
+    }
+
+    printf("}");
+
+    if (usarPlanar) printf(",\"planar\":{\"convert_s\":%.6f,\"composite_s\":%.6f}", tempoConversaoPlanar, tempoComposicaoPlanar);
+
+    printf(",\"bytes_read\":%zu,\"bytes_written\":%zu,\"pixels\":{\"background\":%zu,\"foreground\":%zu,\"blend\":%zu,\"copied\":%zu}}\n",
+           bytesLidos, bytesGravados, contFundo, contFrente, contBorda,
+           nLinB * nColB - (linFim - linIni) * (colFim - colIni));
+    fflush(stdout);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Cria a imagem final aplicando o efeito Chroma Key.
+ *
+ * A imagem é composta em memória, em `saida2D`; a gravação fica com
+ * `gravarSaida()`.
+ */
+void criarImagem()
+{
+    size_t total = (size_t)nLinB * nColB;
+    tpImagem fore = imagemLinhas(fore2D, nLinF, nColF), back = imagemLinhas(back2D, nLinB, nColB);
+    tpImagem saida = imagemLinhas(saida2D, nLinB, nColB), placa = imagemLinhas(placa2D, nLinF, nColF);
+    tpOpcoesChave opcoes;
+    tpRelatorio relatorio;
+    double inicio, duracao;
+
+    montarOpcoes(&opcoes, &relatorio);
+    opcoes.contar = usarStats && !usarBench; /* O benchmark mede só a composição. */
+    if (placa2D != NULL) opcoes.placa = &placa;
+
+    inicio = tempoAtual();
+    comporImagem(&fore, &back, &saida, &opcoes);
+    duracao = tempoAtual() - inicio - relatorio.tempoContagem;
+
+    if (usarPlanar){
+
+        tempoConversaoPlanar = relatorio.tempoConversao;
+        duracao = tempoComposicaoPlanar = relatorio.tempoComposicao;
+    }
+
+    if (relatorioThreads && (raioErosao || raioDilatacao || raioCaixa || raioGauss))
+        fprintf(stderr, "Filtros do matte: %.4f s\n", relatorio.tempoFiltros);
+
+    if (relatorioThreads){
+
+        fprintf(stderr, "Composicao: %d thread(s), %.3f s, %.1f Mpixel/s\n",
+                numThreads, duracao, duracao > 0 ? total / duracao / 1e6 : 0.0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava a imagem composta no formato de `infoS` e fecha o arquivo.
+ *
+ * Em P6 há uma escrita por bloco de linhas; em P3 e QOI os bytes passam pelo
+ * escritor com buffer; em PNG as bandas são comprimidas pelo pool.
+ */
+void gravarSaida()
+{
+    if (strcmp(infoS, "PNG") == 0) gravarPNG(arqSaida, saida2D);
+    else if (strcmp(infoS, "QOI") == 0) gravarQOI(arqSaida, saida2D);
+    else gravarImagem(arqSaida, saida2D);
+
+    if (fclose(arqSaida) != 0){
+
+        printf("Erro ao fechar arquivo de saida.\n");
+        exit(0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Cria a imagem final linha a linha, sem carregar as imagens inteiras.
+ *
+ * Cada linha é lida das duas entradas, composta e gravada imediatamente. Só
+ * existem três buffers de uma linha, então a memória é O(largura) qualquer que
+ * seja a altura. Substitui `alocarImagens()`, `guardaImagens()` e
+ * `criarImagem()` quando `--stream` é usado.
+ */
+void criarImagemStream()
+{
+    tpPixel *linhaBack = (tpPixel *)malloc(sizeof(tpPixel) * nColB);
+    tpPixel *bufferFore = (tpPixel *)malloc(sizeof(tpPixel) * nColF);
+    tpPixel *linhaSaida = (tpPixel *)malloc(sizeof(tpPixel) * nColB);
+    tpImagem back = imagemContigua(linhaBack, 1, nColB), fore = imagemContigua(bufferFore, 1, nColF);
+    tpImagem saida = imagemContigua(linhaSaida, 1, nColB);
+    tpOpcoesChave opcoes;
+    tpRelatorio relatorio;
+    tpEscritor escritor;
+    size_t linhaFore = 0;
+
+    if (linhaBack == NULL || bufferFore == NULL || linhaSaida == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    montarOpcoesFaixa(&opcoes, &relatorio);
+
+    iniciarLeitor(&leitorBack, arqBack);
+    iniciarLeitor(&leitorFore, arqFore);
+    escreverCabecalho(arqSaida);
+    iniciarEscritor(&escritor, arqSaida);
+
+    /* Com --stats as fases se alternam a cada linha e os trechos se somam. */
+    for (size_t i = 0; i < nLinB; i++){
+
+        iniciarFase(FASE_CARGA);
+        lerLinha(&leitorBack, infoB, linhaBack, nColB);
+
+        if (i >= linIni && i < linFim){
+
+            /* Linhas do foreground acima da sobreposição são lidas e descartadas. */
+            while (linhaFore <= i + desvioLin){
+
+                lerLinha(&leitorFore, infoF, bufferFore, nColF);
+                linhaFore++;
+            }
+
+            encerrarFase(FASE_CARGA);
+            iniciarFase(FASE_COMPOSICAO);
+            comporImagem(&fore, &back, &saida, &opcoes);
+            encerrarFase(FASE_COMPOSICAO);
+
+            iniciarFase(FASE_GRAVACAO);
+            escreverLinha(&escritor, linhaSaida, nColB);
+            encerrarFase(FASE_GRAVACAO);
+        }
+
+        else{
+
+            encerrarFase(FASE_CARGA);
+            iniciarFase(FASE_GRAVACAO);
+            escreverLinha(&escritor, linhaBack, nColB);
+            encerrarFase(FASE_GRAVACAO);
+        }
+    } // END_I
+
+    iniciarFase(FASE_GRAVACAO);
+    liberarEscritor(&escritor);
+    encerrarFase(FASE_GRAVACAO);
+
+    iniciarFase(FASE_LIBERACAO);
+    free(linhaBack);
+    free(bufferFore);
+    free(linhaSaida);
+    liberarLeitor(&leitorBack);
+    liberarLeitor(&leitorFore);
+
+    if (fclose(arqBack) != 0 || fclose(arqFore) != 0 || fclose(arqSaida) != 0){
+
+        printf("Erro ao fechar arquivos.\n");
+        exit(1);
+    }
+
+    encerrarFase(FASE_LIBERACAO);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Espera até que um contador do pipeline chegue a `alvo`.
+ *
+ * Gira `GIROS_PIPELINE` vezes, o que cobre a espera típica (uma banda) sem
+ * chamada ao sistema, e depois dorme em `condPipeline` até um
+ * `publicarContador()`. Assim um estágio parado (leitor esperando o disco,
+ * máquina com menos núcleos que threads) não deixa os outros girando.
+ */
+void aguardarContador(atomic_size_t *contador, size_t alvo)
+{
+    for (int giros = 0; giros < GIROS_PIPELINE; giros++){
+
+        if (atomic_load_explicit(contador, memory_order_acquire) >= alvo) return;
+    }
+
+    /* Anuncia-se antes de conferir de novo: quem publica depois disso vê o anúncio. */
+    atomic_fetch_add(&dormindoPipeline, 1);
+    pthread_mutex_lock(&mutexPipeline);
+
+    while (atomic_load(contador) < alvo) pthread_cond_wait(&condPipeline, &mutexPipeline);
+
+    pthread_mutex_unlock(&mutexPipeline);
+    atomic_fetch_sub(&dormindoPipeline, 1);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Publica o novo valor de um contador do pipeline e acorda quem dorme.
+ *
+ * Sem ninguém em `aguardarContador()` dormindo, custa só o armazenamento e
+ * uma leitura atômica.
+ */
+void publicarContador(atomic_size_t *contador, size_t valor)
+{
+    atomic_store(contador, valor);
+
+    if (atomic_load(&dormindoPipeline) > 0){
+
+        pthread_mutex_lock(&mutexPipeline);
+        pthread_cond_broadcast(&condPipeline);
+        pthread_mutex_unlock(&mutexPipeline);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Estágio de leitura do background no `--pipeline`.
+ *
+ * Preenche o slot da banda `k` assim que a banda `k - SLOTS_PIPELINE`, que o
+ * ocupava, foi gravada, e publica `bandasLidasBack`.
+ */
+void *leitorPipelineBack(void *arg)
+{
+    double inicio = tempoAtual(), espera = 0.0;
+
+    (void)arg;
+
+    for (size_t k = 0; k < totalBandasPipeline; k++){
+
+        tpSlotPipeline *slot = &slotsPipeline[k % SLOTS_PIPELINE];
+        size_t ini = k * LINHAS_BANDA;
+        size_t fim = ini + LINHAS_BANDA < nLinB ? ini + LINHAS_BANDA : nLinB;
+
+        if (k >= SLOTS_PIPELINE){
+
+            double t = tempoAtual();
+
+            aguardarContador(&bandasGravadas, k + 1 - SLOTS_PIPELINE);
+            espera += tempoAtual() - t;
+        }
+
+        for (size_t i = ini; i < fim; i++) lerLinha(&leitorBack, infoB, slot->back + (i - ini) * nColB, nColB);
+
+        publicarContador(&bandasLidasBack, k + 1);
+    }
+
+    ocupadoPipeline[0] = tempoAtual() - inicio - espera;
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Estágio de leitura do foreground no `--pipeline`.
+ *
+ * Para cada banda guarda só as linhas do foreground que caem na região
+ * sobreposta; as que ficam acima dela são lidas e descartadas e as de baixo
+ * nem chegam a ser lidas.
+ */
+void *leitorPipelineFore(void *arg)
+{
+    double inicio = tempoAtual(), espera = 0.0;
+    size_t linhaFore = 0;
+
+    (void)arg;
+
+    for (size_t k = 0; k < totalBandasPipeline; k++){
+
+        tpSlotPipeline *slot = &slotsPipeline[k % SLOTS_PIPELINE];
+        size_t ini = k * LINHAS_BANDA;
+        size_t fim = ini + LINHAS_BANDA < nLinB ? ini + LINHAS_BANDA : nLinB;
+
+        if (k >= SLOTS_PIPELINE){
+
+            double t = tempoAtual();
+
+            aguardarContador(&bandasGravadas, k + 1 - SLOTS_PIPELINE);
+            espera += tempoAtual() - t;
+        }
+
+        for (size_t i = ini < linIni ? linIni : ini; i < fim && i < linFim; i++){
+
+            while (linhaFore <= i + desvioLin){
+
+                lerLinha(&leitorFore, infoF, slot->fore + (i - ini) * nColF, nColF);
+                linhaFore++;
+            }
+        }
+
+        publicarContador(&bandasLidasFore, k + 1);
+    }
+
+    ocupadoPipeline[1] = tempoAtual() - inicio - espera;
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Estágio de composição do `--pipeline`, uma thread por trabalhador.
+ *
+ * O trabalhador `t` fica com as bandas `t`, `t + N`, `t + 2N`...; compõe no
+ * próprio buffer do fundo e avisa o gravador pelo contador do slot.
+ */
+void *compositorPipeline(void *arg)
+{
+    int t = (int)(intptr_t)arg;
+    double inicio = tempoAtual(), espera = 0.0;
+    tpOpcoesChave opcoes;
+
+    montarOpcoesFaixa(&opcoes, NULL);
+
+    for (size_t k = (size_t)t; k < totalBandasPipeline; k += (size_t)trabalhadoresPipeline){
+
+        tpSlotPipeline *slot = &slotsPipeline[k % SLOTS_PIPELINE];
+        size_t ini = k * LINHAS_BANDA;
+        size_t fim = ini + LINHAS_BANDA < nLinB ? ini + LINHAS_BANDA : nLinB;
+        double tEspera = tempoAtual();
+
+        aguardarContador(&bandasLidasBack, k + 1);
+        aguardarContador(&bandasLidasFore, k + 1);
+        espera += tempoAtual() - tEspera;
+
+        size_t sobIni = ini < linIni ? linIni : ini;
+        size_t sobFim = fim < linFim ? fim : linFim;
+
+        /* A banda do anel é contígua: uma chamada só, composta no lugar. */
+        if (sobIni < sobFim){
+
+            tpImagem back = imagemContigua(slot->back + (sobIni - ini) * nColB, sobFim - sobIni, nColB);
+            tpImagem fore = imagemContigua(slot->fore + (sobIni - ini) * nColF, sobFim - sobIni, nColF);
+
+            comporImagem(&fore, &back, &back, &opcoes);
+        }
+
+        publicarContador(&slot->composta, k + 1);
+    }
+
+    ocupadoPipeline[3 + t] = tempoAtual() - inicio - espera;
+
+    return NULL;
+}
 
 //-----------------------------------------------------------------------------
 
-typedef struct Pixel
+/**
+ * @brief Estágio de gravação do `--pipeline`: grava as bandas na ordem e libera os slots.
+ */
+void *gravadorPipeline(void *arg)
 {
-    unsigned char R;
-    unsigned char G;
-    unsigned char B;
-} tpPixel;
+    tpEscritor escritor;
+    double inicio = tempoAtual(), espera = 0.0;
 
-//-----------------------------------------------------------------------------
+    (void)arg;
 
-char infoB[4], infoF[4];
-unsigned char maxValB, maxValF;
-short int nLinB, nLinF, nColB, nColF;
+    escreverCabecalho(arqSaida);
+    iniciarEscritor(&escritor, arqSaida);
 
-FILE *arqFore, *arqBack, *arqSaida;
+    for (size_t k = 0; k < totalBandasPipeline; k++){
 
-unsigned char chaveR, chaveG, chaveB;
-int distancia, tolerancia;
-short int provR, provG, provB, provTol;
+        tpSlotPipeline *slot = &slotsPipeline[k % SLOTS_PIPELINE];
+        size_t ini = k * LINHAS_BANDA;
+        size_t fim = ini + LINHAS_BANDA < nLinB ? ini + LINHAS_BANDA : nLinB;
+        double t = tempoAtual();
 
-tpPixel *back1D, *fore1D;
-tpPixel **back2D, **fore2D;
+        aguardarContador(&slot->composta, k + 1);
+        espera += tempoAtual() - t;
 
-//-----------------------------------------------------------------------------
+        for (size_t i = ini; i < fim; i++) escreverLinha(&escritor, slot->back + (i - ini) * nColB, nColB);
 
-void abrirArquivos(int argc, char *argv[]);
-void lerCabecalhos(void);
-void validarDados(void);
-void alocarImagens(void);
-void guardaImagens(void);
-void criarImagem(void);
-void liberaAlocacoes(void);
+        publicarContador(&bandasGravadas, k + 1);
+    }
+
+    liberarEscritor(&escritor);
+
+    ocupadoPipeline[2] = tempoAtual() - inicio - espera;
+
+    return NULL;
+}
 
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Abre os arquivos e processa os argumentos da linha de comando.
+ * @brief Cria a imagem final com leitura, composição e gravação sobrepostas.
+ *
+ * Usado com `--pipeline`. Duas threads leem o background e o foreground,
+ * `numThreads` trabalhadores compõem e uma thread grava, todas ao mesmo tempo
+ * sobre um anel de `SLOTS_PIPELINE` bandas de `LINHAS_BANDA` linhas. Cada
+ * contador do anel tem um único produtor e é só lido pelos outros estágios,
+ * então a passagem de bandas não usa mutex. Com a E/S e a composição em
+ * paralelo, o tempo total tende ao do estágio mais lento, não à soma deles. A
+ * memória, como em `--stream`, não depende da altura das imagens.
  */
-void abrirArquivos(int argc, char *argv[])
+void criarImagemPipeline()
 {
-    if (argc < 8){
+    pthread_t leitorB, leitorF, gravador;
+    pthread_t *trabalhadores;
+    double inicio, composicao = 0.0;
 
-        printf("Instr. de uso: <prog> <imgForeground> <imgBackground> <imgSaida> <chaveR> <chaveG> <chaveB> <tolerancia>\n\n");
-        exit(0);
+    trabalhadoresPipeline = numThreads;
+    totalBandasPipeline = (nLinB + LINHAS_BANDA - 1) / LINHAS_BANDA;
+    trabalhadores = (pthread_t *)malloc(sizeof(pthread_t) * trabalhadoresPipeline);
+    ocupadoPipeline = (double *)calloc(3 + trabalhadoresPipeline, sizeof(double));
+
+    if (trabalhadores == NULL || ocupadoPipeline == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
     }
 
-    arqFore = fopen(argv[1], "r");
-    arqBack = fopen(argv[2], "r");
+    for (int k = 0; k < SLOTS_PIPELINE; k++){
 
-    if (arqFore == NULL || arqBack == NULL){
+        slotsPipeline[k].back = (tpPixel *)malloc(sizeof(tpPixel) * LINHAS_BANDA * nColB);
+        slotsPipeline[k].fore = (tpPixel *)malloc(sizeof(tpPixel) * LINHAS_BANDA * nColF);
+        atomic_init(&slotsPipeline[k].composta, 0);
 
-        printf("Erro ao abrir algum dos arquivos\n");
-        exit(1);
+        if (slotsPipeline[k].back == NULL || slotsPipeline[k].fore == NULL){
+
+            printf("Erro ao alocar.\n");
+            exit(1);
+        }
     }
 
-    arqSaida = fopen(argv[3], "w");
+    atomic_init(&bandasLidasBack, 0);
+    atomic_init(&bandasLidasFore, 0);
+    atomic_init(&bandasGravadas, 0);
+    atomic_init(&dormindoPipeline, 0);
 
-    if (arqSaida == NULL){
+    iniciarLeitor(&leitorBack, arqBack);
+    iniciarLeitor(&leitorFore, arqFore);
 
-        printf("Erro ao criar arquivo de saida\n");
+    inicio = tempoAtual();
+
+    if (pthread_create(&leitorB, NULL, leitorPipelineBack, NULL) != 0 ||
+        pthread_create(&leitorF, NULL, leitorPipelineFore, NULL) != 0 ||
+        pthread_create(&gravador, NULL, gravadorPipeline, NULL) != 0){
+
+        printf("Erro ao criar threads.\n");
         exit(1);
     }
 
-    provR = atoi(argv[4]);
-    provG = atoi(argv[5]);
-    provB = atoi(argv[6]);
-    provTol = atoi(argv[7]);
+    for (int t = 0; t < trabalhadoresPipeline; t++){
+
+        if (pthread_create(&trabalhadores[t], NULL, compositorPipeline, (void *)(intptr_t)t) != 0){
+
+            printf("Erro ao criar threads.\n");
+            exit(1);
+        }
+    }
+
+    pthread_join(leitorB, NULL);
+    pthread_join(leitorF, NULL);
+    for (int t = 0; t < trabalhadoresPipeline; t++) pthread_join(trabalhadores[t], NULL);
+    pthread_join(gravador, NULL);
+
+    if (relatorioThreads){
+
+        for (int t = 0; t < trabalhadoresPipeline; t++) composicao += ocupadoPipeline[3 + t];
+
+        fprintf(stderr, "Pipeline: leitura %.3f s (fundo) e %.3f s (foreground), composicao %.3f s (%d thread(s)), gravacao %.3f s, total %.3f s\n",
+                ocupadoPipeline[0], ocupadoPipeline[1], composicao / trabalhadoresPipeline, trabalhadoresPipeline,
+                ocupadoPipeline[2], tempoAtual() - inicio);
+    }
+
+    for (int k = 0; k < SLOTS_PIPELINE; k++){
+
+        free(slotsPipeline[k].back);
+        free(slotsPipeline[k].fore);
+    }
+
+    free(trabalhadores);
+    free(ocupadoPipeline);
+    ocupadoPipeline = NULL;
+    liberarLeitor(&leitorBack);
+    liberarLeitor(&leitorFore);
+
+    if (fclose(arqBack) != 0 || fclose(arqFore) != 0 || fclose(arqSaida) != 0){
+
+        printf("Erro ao fechar arquivos.\n");
+        exit(1);
+    }
 }
 
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Lê os cabeçalhos das imagens PPM.
+ * @brief Cria a imagem final para entradas de mais de 8 bits por canal.
+ *
+ * Substitui `alocarImagens()`, `guardaImagens()` e `criarImagem()` quando a
+ * intensidade máxima passa de 255: as imagens são lidas em `tpPixel16`,
+ * compostas por `compor()` e gravadas com a mesma intensidade
+ * máxima das entradas.
  */
-void lerCabecalhos(void)
+void criarImagem16()
 {
-    fscanf(arqBack, "%s\n", infoB);
-    fscanf(arqBack, "%hd %hd\n", &nColB, &nLinB);
-    fscanf(arqBack, "%hhu\n", &maxValB);
+    size_t total = (size_t)nLinB * nColB;
+    tpImagem fore, back, saida;
+    tpOpcoesChave opcoes;
+    tpRelatorio relatorio;
+    double inicio, duracao;
+    tpEscritor escritor;
+
+    iniciarFase(FASE_CARGA);
+    back16 = reservarImagem16(&blocosBack16, nLinB, nColB);
+    fore16 = reservarImagem16(&blocosFore16, nLinF, nColF);
+    saida16 = reservarImagem16(&blocosSaida16, nLinB, nColB);
+
+    iniciarLeitor(&leitorBack, arqBack);
+    iniciarLeitor(&leitorFore, arqFore);
+
+    for (size_t i = 0; i < nLinB; i++) lerLinha16(&leitorBack, infoB, back16[i], nColB);
+    for (size_t i = 0; i < nLinF; i++) lerLinha16(&leitorFore, infoF, fore16[i], nColF);
+
+    liberarLeitor(&leitorBack);
+    liberarLeitor(&leitorFore);
+
+    if (fclose(arqBack) != 0 || fclose(arqFore) != 0){
+
+        printf("Erro ao guardar imagens.\n");
+        exit(1);
+    }
+
+    encerrarFase(FASE_CARGA);
+    iniciarFase(FASE_COMPOSICAO);
+
+    fore = imagemLinhas16(fore16, nLinF, nColF);
+    back = imagemLinhas16(back16, nLinB, nColB);
+    saida = imagemLinhas16(saida16, nLinB, nColB);
+    montarOpcoes(&opcoes, &relatorio);
 
-    fscanf(arqFore, "%s\n", infoF);
-    fscanf(arqFore, "%hd %hd\n", &nColF, &nLinF);
-    fscanf(arqFore, "%hhu\n", &maxValF);
+    inicio = tempoAtual();
+    comporImagem(&fore, &back, &saida, &opcoes);
+    duracao = tempoAtual() - inicio - relatorio.tempoContagem;
+
+    encerrarFase(FASE_COMPOSICAO);
+
+    if (relatorioThreads){
+
+        fprintf(stderr, "Composicao (16 bits): %d thread(s), %.3f s, %.1f Mpixel/s\n",
+                numThreads, duracao, duracao > 0 ? total / duracao / 1e6 : 0.0);
+    }
+
+    iniciarFase(FASE_GRAVACAO);
+    escreverCabecalho(arqSaida);
+    iniciarEscritor(&escritor, arqSaida);
+
+    for (size_t i = 0; i < nLinB; i++) escreverLinha16(&escritor, saida16[i], nColB);
+
+    liberarEscritor(&escritor);
+
+    if (fclose(arqSaida) != 0){
+
+        printf("Erro ao fechar arquivo de saida.\n");
+        exit(1);
+    }
+
+    encerrarFase(FASE_GRAVACAO);
 }
 
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Valida todos os dados de entrada para garantir a consistência.
+ * @brief Lê o quadro `numero` da sequência para o buffer `q`.
+ *
+ * O buffer só é realocado quando o quadro não cabe nele, então numa sequência
+ * de quadros do mesmo tamanho nenhuma alocação é feita depois do primeiro.
  */
-void validarDados()
+void lerQuadro(int numero, tpQuadro *q)
 {
-    if (provR > 255 || provR < 0 || provG > 255 || provG < 0 || provB > 255 || provB < 0){
+    char nome[4096], info[4];
+    size_t maxVal;
+    FILE *arq;
+    tpLeitor leitor;
+
+    snprintf(nome, sizeof(nome), padraoFore, numero);
+    arq = fopen(nome, "rb");
 
-        printf("Insira apenas valores entre 0 e 255 para RGB\n");
+    if (arq == NULL || fscanf(arq, "%3s", info) != 1){
+
+        printf("Erro ao abrir o quadro %s\n", nome);
         exit(1);
     }
 
-    chaveR = provR;
-    chaveG = provG;
-    chaveB = provB;
-
-    if (provTol > 441) tolerancia = 441;
-    else if (provTol < 0) tolerancia = 0;
-    else tolerancia = provTol;
+    q->nCol = lerValorCabecalho(arq);
+    q->nLin = lerValorCabecalho(arq);
+    maxVal = lerValorCabecalho(arq);
 
-    if (strcmp(infoB, infoF) != 0){
+    if (q->nCol == 0 || q->nLin == 0 || maxVal == 0){
 
-        printf("Ambos arquivos devem ter o formato P3.\n");
+        printf("Cabecalho PPM invalido.\n");
         exit(1);
     }
 
-    if (nColF > nColB || nLinF > nLinB){
+    if ((strcmp(info, "P3") != 0 && strcmp(info, "P6") != 0) || (strcmp(info, "P6") == 0 && maxVal > 255)){
 
-        printf("O arquivo foreground precisa ser menor que o background.\n");
+        printf("O quadro %s deve estar no formato P3 ou P6 de 8 bits.\n", nome);
         exit(1);
     }
 
-    if (maxValB != maxValF){
+    if (maxVal != (size_t)maxValB || (q->nCol > 0 && q->nLin > SIZE_MAX / sizeof(tpPixel16) / q->nCol)){
 
-        printf("Os arquivos tem maxima intensidade diferente.\n");
+        printf("O quadro %s e incompativel com o background.\n", nome);
         exit(1);
     }
+
+    if (q->pixels2D == NULL || q->blocos.bytesLinha != sizeof(tpPixel) * q->nCol ||
+        q->nLin > q->blocos.nBlocos * q->blocos.linhasPorBloco){
+
+        liberarBlocos(&q->blocos);
+        free(q->pixels2D);
+        q->pixels2D = reservarImagem(&q->blocos, q->nLin, q->nCol);
+    }
+
+    iniciarLeitor(&leitor, arq);
+    lerPixels(&leitor, info, q->pixels2D, q->nLin, q->nCol);
+    liberarLeitor(&leitor);
+    fclose(arq);
 }
 
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Aloca a memória necessária para armazenar as duas imagens.
+ * @brief Grava o quadro composto `numero` no arquivo dado por `padraoSaida`.
  */
-void alocarImagens()
+void gravarQuadro(int numero, tpPixel **img2D)
 {
-    short int i = 0;
+    char nome[4096];
+    FILE *arq;
 
-    back1D = (tpPixel *)malloc(sizeof(tpPixel) * nLinB * nColB);
-    fore1D = (tpPixel *)malloc(sizeof(tpPixel) * nLinF * nColF);
+    snprintf(nome, sizeof(nome), padraoSaida, numero);
+    arq = fopen(nome, "wb");
 
-    if (back1D == NULL || fore1D == NULL){
+    if (arq == NULL){
 
-        printf("Erro ao alocar.\n");
+        printf("Erro ao criar arquivo de saida %s\n", nome);
         exit(1);
     }
 
-    back2D = (tpPixel **)malloc(sizeof(tpPixel *) * nLinB);
-    fore2D = (tpPixel **)malloc(sizeof(tpPixel *) * nLinF);
+    gravarImagem(arq, img2D);
 
-    if (back2D == NULL || fore2D == NULL){
+    if (fclose(arq) != 0){
 
-        printf("Erro ao alocar.\n");
-        free(back1D);
-        free(fore1D);
-        back1D = fore1D = NULL;
+        printf("Erro ao fechar arquivo de saida.\n");
         exit(1);
     }
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Thread leitora: carrega os quadros seguintes nos buffers livres.
+ */
+void *leitorSequencia(void *arg)
+{
+    (void)arg;
+
+    for (int n = primeiroQuadro + 1; n <= ultimoQuadro; n++){
+
+        tpQuadro *q = &entradas[(n - primeiroQuadro) % 2];
 
-    while (i < nLinB){
+        pthread_mutex_lock(&mutexSeq);
+        while (q->cheio) pthread_cond_wait(&condSeq, &mutexSeq);
+        pthread_mutex_unlock(&mutexSeq);
 
-        back2D[i] = back1D + i * nColB;
-        i++;
+        lerQuadro(n, q);
+
+        pthread_mutex_lock(&mutexSeq);
+        q->cheio = 1;
+        pthread_cond_broadcast(&condSeq);
+        pthread_mutex_unlock(&mutexSeq);
     }
 
-    i = 0;
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Thread gravadora: grava os quadros compostos e libera seus buffers.
+ */
+void *gravadorSequencia(void *arg)
+{
+    (void)arg;
+
+    for (int n = primeiroQuadro; n <= ultimoQuadro; n++){
+
+        tpQuadro *q = &saidas[(n - primeiroQuadro) % 2];
 
-    while (i < nLinF){
+        pthread_mutex_lock(&mutexSeq);
+        while (!q->cheio) pthread_cond_wait(&condSeq, &mutexSeq);
+        pthread_mutex_unlock(&mutexSeq);
 
-        fore2D[i] = fore1D + i * nColF;
-        i++;
+        gravarQuadro(n, q->pixels2D);
+
+        pthread_mutex_lock(&mutexSeq);
+        q->cheio = 0;
+        pthread_cond_broadcast(&condSeq);
+        pthread_mutex_unlock(&mutexSeq);
     }
+
+    return NULL;
 }
 
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Lê os dados de pixel dos arquivos e os guarda na memória alocada.
+ * @brief Compõe a sequência de quadros `primeiroQuadro`..`ultimoQuadro`.
+ *
+ * O background e o primeiro quadro já foram carregados por `guardaImagens()`.
+ * Há dois buffers de entrada e dois de saída: a thread leitora preenche o
+ * próximo quadro, a principal compõe o atual (com `--threads` threads) e a
+ * gravadora grava o anterior.
  */
-void guardaImagens()
+void criarSequencia()
 {
-    for (short int i = 0; i < nLinB; i++){
-        for (short int j = 0; j < nColB; j++){
+    pthread_t leitor, gravador;
+    tpPixel **saidaOriginal = saida2D;
+    tpImagem back = imagemLinhas(back2D, nLinB, nColB), placa;
+    tpOpcoesChave opcoes;
 
-            fscanf(arqBack, "%hhu ", &back2D[i][j].R);
-            fscanf(arqBack, "%hhu ", &back2D[i][j].G);
-            fscanf(arqBack, "%hhu ", &back2D[i][j].B);
-        }
+    montarOpcoes(&opcoes, NULL);
+    opcoes.contar = 0;
+
+    entradas[0].pixels2D = fore2D;
+    entradas[0].blocos = blocosFore;
+    entradas[0].nLin = nLinF;
+    entradas[0].nCol = nColF;
+    entradas[0].cheio = 1;
+
+    saidas[0].pixels2D = saida2D;
+    saidas[1].pixels2D = reservarImagem(&saidas[1].blocos, nLinB, nColB);
+
+    if (pthread_create(&leitor, NULL, leitorSequencia, NULL) != 0 ||
+        pthread_create(&gravador, NULL, gravadorSequencia, NULL) != 0){
+
+        printf("Erro ao criar threads.\n");
+        exit(1);
     }
 
-    for (short int i = 0; i < nLinF; i++){
-        for (short int j = 0; j < nColF; j++){
+    for (int n = primeiroQuadro; n <= ultimoQuadro; n++){
+
+        tpQuadro *entrada = &entradas[(n - primeiroQuadro) % 2];
+        tpQuadro *saida = &saidas[(n - primeiroQuadro) % 2];
+
+        pthread_mutex_lock(&mutexSeq);
+        while (!entrada->cheio || saida->cheio) pthread_cond_wait(&condSeq, &mutexSeq);
+        pthread_mutex_unlock(&mutexSeq);
+
+        fore2D = entrada->pixels2D;
+        nLinF = entrada->nLin;
+        nColF = entrada->nCol;
+        saida2D = saida->pixels2D;
+        calcularSobreposicao();
 
-            fscanf(arqFore, "%hhu ", &fore2D[i][j].R);
-            fscanf(arqFore, "%hhu ", &fore2D[i][j].G);
-            fscanf(arqFore, "%hhu ", &fore2D[i][j].B);
+        if (placa2D != NULL && (nLinF != nLinPlaca || nColF != nColPlaca)){
+
+            printf("O quadro %d nao tem as dimensoes da placa limpa.\n", n);
+            exit(1);
         }
-    }
 
-    if (fclose(arqBack) != 0 || fclose(arqFore) != 0){
+        {
+            tpImagem fore = imagemLinhas(fore2D, nLinF, nColF), saida = imagemLinhas(saida2D, nLinB, nColB);
 
-        printf("Erro ao guardar imagens.\n");
-        exit(1);
+            placa = imagemLinhas(placa2D, nLinF, nColF);
+            opcoes.placa = placa2D != NULL ? &placa : NULL;
+            comporImagem(&fore, &back, &saida, &opcoes);
+        }
+
+        pthread_mutex_lock(&mutexSeq);
+        entrada->cheio = 0;
+        saida->cheio = 1;
+        pthread_cond_broadcast(&condSeq);
+        pthread_mutex_unlock(&mutexSeq);
     }
+
+    pthread_join(leitor, NULL);
+    pthread_join(gravador, NULL);
+
+    fore2D = entradas[0].pixels2D;
+    blocosFore = entradas[0].blocos;
+    saida2D = saidaOriginal;
+
+    liberarBlocos(&entradas[1].blocos);
+    free(entradas[1].pixels2D);
+    liberarBlocos(&saidas[1].blocos);
+    free(saidas[1].pixels2D);
 }
 
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Cria a imagem final aplicando o efeito Chroma Key.
+ * @brief Gerador pseudoaleatório xorshift32: a mesma semente dá as mesmas imagens.
  */
-void criarImagem()
+unsigned int proximoAleatorio(unsigned int *estado)
 {
-    unsigned char atualR, atualG, atualB;
-    tolerancia = tolerancia * tolerancia;
+    unsigned int x = *estado;
 
-    fprintf(arqSaida, "P3\n");
-    fprintf(arqSaida, "%hd %hd\n", nColB, nLinB);
-    fprintf(arqSaida, "%hhu\n", maxValB);
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
 
-    for (short int i = 0; i < nLinB; i++){
-        for (short int j = 0; j < nColB; j++){
+    return *estado = x;
+}
+
+//-----------------------------------------------------------------------------
 
-            if (i < nLinF && j < nColF){
+/**
+ * @brief Grava em `arq` uma imagem sintética no formato `infoS` e devolve seu tamanho.
+ *
+ * Uma fração `cobertura` (0 a 1) dos pixels fica a até 8 níveis por canal da
+ * chave do benchmark, sempre dentro de `TOL_BENCH`; os demais são aleatórios.
+ * Com cobertura 0 a imagem serve de background.
+ */
+size_t gerarImagemSintetica(FILE *arq, size_t nLin, size_t nCol, double cobertura, unsigned int semente)
+{
+    tpPixel *linha = (tpPixel *)malloc(sizeof(tpPixel) * nCol);
+    unsigned int limite = (unsigned int)(cobertura * 65536.0);
+    tpEscritor escritor;
+    long tamanho;
 
-                atualR = fore2D[i][j].R;
-                atualG = fore2D[i][j].G;
-                atualB = fore2D[i][j].B;
+    if (linha == NULL){
 
-                distancia = (atualR - chaveR) * (atualR - chaveR)
-                          + (atualG - chaveG) * (atualG - chaveG)
-                          + (atualB - chaveB) * (atualB - chaveB);
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
 
-                if (distancia < tolerancia){
+    fprintf(arq, "%s\n%zu %zu\n255\n", infoS, nCol, nLin);
+    iniciarEscritor(&escritor, arq);
 
-                    fprintf(arqSaida, "%hhu %hhu %hhu\n", back2D[i][j].R, back2D[i][j].G, back2D[i][j].B);
-                }
+    for (size_t i = 0; i < nLin; i++){
 
-                else if (distancia > tolerancia){
+        for (size_t j = 0; j < nCol; j++){
 
-                    fprintf(arqSaida, "%hhu %hhu %hhu\n", fore2D[i][j].R, fore2D[i][j].G, fore2D[i][j].B);
-                }
+            unsigned int a = proximoAleatorio(&semente);
 
-                else{
+            if ((a & 0xFFFF) < limite){
 
-                    fprintf(arqSaida, "%hhu %hhu %hhu\n", ((back2D[i][j].R + fore2D[i][j].R) / 2),
-                                                          ((back2D[i][j].G + fore2D[i][j].G) / 2),
-                                                          ((back2D[i][j].B + fore2D[i][j].B) / 2));
-                }
+                linha[j].R = (a >> 16) & 7;
+                linha[j].G = CHAVE_BENCH_G - ((a >> 19) & 7);
+                linha[j].B = (a >> 22) & 7;
             }
 
             else{
 
-                fprintf(arqSaida, "%hhu %hhu %hhu\n", back2D[i][j].R, back2D[i][j].G, back2D[i][j].B);
+                linha[j].R = a >> 24;
+                linha[j].G = a >> 16;
+                linha[j].B = proximoAleatorio(&semente) >> 24;
             }
-        } // END_J
-    } // END_I
+        }
 
-    if (fclose(arqSaida) != 0){
+        escreverLinha(&escritor, linha, nCol);
+    }
 
-        printf("Erro ao fechar arquivo de saida.\n");
-        exit(0);
+    liberarEscritor(&escritor);
+    free(linha);
+
+    fflush(arq);
+    tamanho = ftell(arq);
+    rewind(arq);
+
+    return tamanho > 0 ? (size_t)tamanho : 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Executa o benchmark de `--bench`: gera as entradas e mede cada fase.
+ *
+ * Foreground e background têm a resolução pedida e são gravados em arquivos
+ * temporários no formato de `--format` (P6 por padrão), com a chave (0, 255, 0)
+ * e tolerância `TOL_BENCH`. As fases medidas são as mesmas do uso normal, com
+ * as mesmas opções (`--threads`, `--simd`, `--mmap`, `--planar`, `--soft`).
+ */
+void executarBenchmark()
+{
+    size_t pixels = larguraBench * alturaBench, bytesEntrada, bytesSaida;
+    double inicio, tCabecalho, tCarga, tComposicao, tGravacao, tEspaco[2] = {0.0, 0.0}, tEmpacotado = 0.0;
+    tpImagem fore, back, saida;
+    tpOpcoesChave opcoes;
+    long tamanho;
+
+    if (usarStream || usarSeq){
+
+        printf("O benchmark nao aceita --stream nem --seq.\n");
+        exit(1);
+    }
+
+    if (infoS[0] == '\0') strcpy(infoS, "P6");
+
+    arqFore = tmpfile();
+    arqBack = tmpfile();
+    arqSaida = tmpfile();
+
+    if (arqFore == NULL || arqBack == NULL || arqSaida == NULL){
+
+        printf("Erro ao criar arquivos temporarios.\n");
+        exit(1);
+    }
+
+    bytesEntrada = gerarImagemSintetica(arqFore, alturaBench, larguraBench, coberturaBench / 100.0, 12345u);
+    bytesEntrada += gerarImagemSintetica(arqBack, alturaBench, larguraBench, 0.0, 67890u);
+
+    provR = 0;
+    provG = CHAVE_BENCH_G;
+    provB = 0;
+    provTol = TOL_BENCH;
+
+    inicio = tempoAtual();
+    lerCabecalhos();
+    validarDados();
+    selecionarKernel();
+    tCabecalho = tempoAtual() - inicio;
+
+    inicio = tempoAtual();
+    alocarImagens();
+    guardaImagens();
+    tCarga = tempoAtual() - inicio;
+
+    inicio = tempoAtual();
+    criarImagem();
+    tComposicao = tempoAtual() - inicio;
+
+    /*
+     * Repete a composição, já com a saída na memória, em cada espaço de cor
+     * para comparar os dois na mesma entrada. A última passada é a do espaço
+     * pedido, então a saída gravada não muda. Com filtros do matte a saída
+     * vem do matte filtrado, que estas passadas sobrescreveriam com a
+     * composição sem filtro, então elas não são feitas.
+     */
+    fore = imagemLinhas(fore2D, nLinF, nColF);
+    back = imagemLinhas(back2D, nLinB, nColB);
+    saida = imagemLinhas(saida2D, nLinB, nColB);
+    montarOpcoes(&opcoes, NULL);
+    opcoes.contar = 0;
+
+    if (!usarSuave && !usarPlanar && !(raioErosao || raioDilatacao || raioCaixa || raioGauss)){
+
+        for (int e = 0; e < 2; e++){
+
+            opcoes.espaco = e == 0 ? !espacoCor : espacoCor;
+
+            inicio = tempoAtual();
+            comporImagem(&fore, &back, &saida, &opcoes);
+            tEspaco[opcoes.espaco] = tempoAtual() - inicio;
+        }
+    }
+
+    /* Com --planar, a mesma composição sobre os pixels empacotados, para o ganho. */
+    if (usarPlanar){
+
+        opcoes.planar = 0;
+
+        inicio = tempoAtual();
+        comporImagem(&fore, &back, &saida, &opcoes);
+        tEmpacotado = tempoAtual() - inicio;
+    }
+
+    inicio = tempoAtual();
+    gravarImagem(arqSaida, saida2D);
+    fflush(arqSaida);
+    tGravacao = tempoAtual() - inicio;
+
+    tamanho = ftell(arqSaida);
+    bytesSaida = tamanho > 0 ? (size_t)tamanho : 0;
+    fclose(arqSaida);
+
+    liberaAlocacoes();
+
+    printf("Benchmark %zux%zu, cobertura %.1f%%, %s, kernel %s, espaco %s, %d thread(s)\n",
+           larguraBench, alturaBench, coberturaBench, infoS, nomeKernel, espacoCor == ESPACO_CBCR ? "cbcr" : "rgb", numThreads);
+    printf("%-12s %10s %10s %10s\n", "fase", "tempo (s)", "MB/s", "Mpixel/s");
+    printf("%-12s %10.4f %10s %10s\n", "cabecalho", tCabecalho, "-", "-");
+    printf("%-12s %10.4f %10.1f %10.1f\n", "carga", tCarga,
+           tCarga > 0 ? bytesEntrada / tCarga / 1e6 : 0.0, tCarga > 0 ? 2.0 * pixels / tCarga / 1e6 : 0.0);
+    printf("%-12s %10.4f %10.1f %10.1f\n", "composicao", tComposicao,
+           tComposicao > 0 ? 3.0 * sizeof(tpPixel) * pixels / tComposicao / 1e6 : 0.0,
+           tComposicao > 0 ? pixels / tComposicao / 1e6 : 0.0);
+    printf("%-12s %10.4f %10.1f %10.1f\n", "gravacao", tGravacao,
+           tGravacao > 0 ? bytesSaida / tGravacao / 1e6 : 0.0, tGravacao > 0 ? pixels / tGravacao / 1e6 : 0.0);
+
+    for (int e = 0; e < 2; e++){
+
+        if (tEspaco[e] > 0){
+
+            printf("%-12s %10.4f %10.1f %10.1f\n", e == ESPACO_RGB ? "comp. rgb" : "comp. cbcr", tEspaco[e],
+                   3.0 * sizeof(tpPixel) * pixels / tEspaco[e] / 1e6, pixels / tEspaco[e] / 1e6);
+        }
+    }
+
+    if (usarPlanar && tEmpacotado > 0 && tempoComposicaoPlanar > 0){
+
+        printf("%-12s %10.4f %10s %10.1f\n", "conv. planar", tempoConversaoPlanar, "-",
+               tempoConversaoPlanar > 0 ? pixels / tempoConversaoPlanar / 1e6 : 0.0);
+        printf("%-12s %10.4f %10s %10.1f\n", "comp. planar", tempoComposicaoPlanar, "-", pixels / tempoComposicaoPlanar / 1e6);
+        printf("%-12s %10.4f %10s %10.1f\n", "comp. rgb", tEmpacotado, "-", pixels / tEmpacotado / 1e6);
+        printf("Ganho do planar: %.2fx so na composicao, %.2fx com a conversao\n", tEmpacotado / tempoComposicaoPlanar,
+               tEmpacotado / (tempoComposicaoPlanar + tempoConversaoPlanar));
     }
 }
 
 //-----------------------------------------------------------------------------
 
 /**
- * @brief Libera toda a memória que foi alocada dinamicamente com `malloc`.
+ * @brief Libera toda a memória que foi alocada dinamicamente com `malloc` ou
+ * mapeada com `mmap`.
  */
 void liberaAlocacoes()
 {
-    free(back1D);
-    free(fore1D);
+#ifdef CHROMA_MMAP
+    if (mapaBack != NULL) munmap(mapaBack, tamMapaBack);
+    if (mapaFore != NULL) munmap(mapaFore, tamMapaFore);
+#endif
+
+    liberarBlocos(&blocosBack);
+    liberarBlocos(&blocosFore);
+    liberarBlocos(&blocosSaida);
+    liberarBlocos(&blocosPlaca);
+    if (saida2D != back2D) free(saida2D);
+    free(placa2D);
+    placa2D = NULL;
     back1D = fore1D = NULL;
+    saida2D = NULL;
+    mapaBack = mapaFore = NULL;
+
+    liberarBlocos(&blocosBack16);
+    liberarBlocos(&blocosFore16);
+    liberarBlocos(&blocosSaida16);
+    free(back16);
+    free(fore16);
+    free(saida16);
+    back16 = fore16 = saida16 = NULL;
 
     free(back2D);
     free(fore2D);
@@ -300,13 +3875,80 @@ void liberaAlocacoes()
 
 int main(int argc, char *argv[])
 {
+    /* `--stats` só é conhecido depois de abrirArquivos(), então a abertura é marcada à mão. */
+    inicioParede[FASE_ABERTURA] = tempoAtual();
+    inicioCPU[FASE_ABERTURA] = tempoCPU();
+
     abrirArquivos(argc, argv);
+    encerrarFase(FASE_ABERTURA);
+
+    if (usarBench){
+
+        executarBenchmark();
+        return 0;
+    }
+
+
+    iniciarFase(FASE_CABECALHO);
     lerCabecalhos();
     validarDados();
+    selecionarKernel();
+    encerrarFase(FASE_CABECALHO);
+
+    if (usarPipeline){
+
+        criarImagemPipeline();
+        return 0;
+    }
+
+    if (usarStream){
+
+        criarImagemStream();
+        if (usarStats) imprimirEstatisticas("stream");
+        return 0;
+    }
+
+    if (maxValB > 255){
+
+        criarImagem16();
+
+        iniciarFase(FASE_LIBERACAO);
+        liberaAlocacoes();
+        encerrarFase(FASE_LIBERACAO);
+
+        if (usarStats) imprimirEstatisticas("16bit");
+        return 0;
+    }
+
+    iniciarPool();
+
+    iniciarFase(FASE_CARGA);
     alocarImagens();
     guardaImagens();
-    criarImagem();
+    if (arqPlaca != NULL) carregarPlaca();
+    encerrarFase(FASE_CARGA);
+
+    if (usarAuto) detectarChave();
+
+    if (usarSeq) criarSequencia();
+    else{
+
+        /* Com --stats, a contagem é feita por compor(), que separa o tempo dela. */
+        iniciarFase(FASE_COMPOSICAO);
+        criarImagem();
+        encerrarFase(FASE_COMPOSICAO);
+
+        iniciarFase(FASE_GRAVACAO);
+        gravarSaida();
+        encerrarFase(FASE_GRAVACAO);
+    }
+
+    iniciarFase(FASE_LIBERACAO);
+    encerrarPool();
     liberaAlocacoes();
+    encerrarFase(FASE_LIBERACAO);
+
+    if (usarStats) imprimirEstatisticas(usarSuave ? "soft" : usarPlanar ? "planar" : usarDiferenca ? "diff" : "memory");
 
     return 0;
 }
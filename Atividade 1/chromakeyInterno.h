@@ -0,0 +1,179 @@
+/**
+ * @file chromakeyInterno.h
+ * @brief Definições compartilhadas entre o núcleo (`chromakey.c`) e o
+ * programa de linha de comando (`chromakeyFinal.c`), fora da interface pública.
+ *
+ * As funções são `static inline` e as tabelas `static`, então cada arquivo
+ * que inclui este cabeçalho tem a sua cópia e nada daqui é exportado pela
+ * biblioteca.
+ *
+ * @author Társis Barreto
+ * @author Isaque Passos
+ */
+
+#ifndef CHROMAKEY_INTERNO_H
+#define CHROMAKEY_INTERNO_H
+
+#include "chromakey.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CHROMA_X86
+#include <immintrin.h>
+#endif
+
+#define ESPACO_RGB CHROMA_ESPACO_RGB /**< Distância euclidiana em RGB. */
+#define ESPACO_CBCR CHROMA_ESPACO_CBCR /**< Distância só em Cb e Cr (BT.601, inteiros). */
+
+#define LINHAS_BANDA 16 /**< Linhas por banda de trabalho, na biblioteca e nos modos do programa. */
+
+/**
+ * @brief Chave já preparada para os kernels: cor e tolerância ao quadrado.
+ *
+ * Passada por ponteiro a cada chamada, permite que composições com chaves
+ * diferentes rodem ao mesmo tempo.
+ */
+typedef struct Chave
+{
+    int R, G, B;
+    int Cb, Cr; /**< Crominância da chave, de `calcularCb()` e `calcularCr()`. */
+    int espaco; /**< `ESPACO_RGB` ou `ESPACO_CBCR`. */
+    int despill; /**< Canal dominante da chave a limitar (0 = R, 1 = G, 2 = B) ou -1. */
+    int tolerancia;
+} tpChave;
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Componente Cb de um pixel, centrada em zero (-128 a 127).
+ *
+ * Coeficientes BT.601 escalados por 256 e arredondados; o deslocamento
+ * aritmético arredonda para baixo. Todos os produtos e somas cabem em 16 bits
+ * com sinal, que é como os kernels vetorizados fazem a mesma conta.
+ */
+static inline int calcularCb(int R, int G, int B)
+{
+    return (-43 * R - 85 * G + 128 * B) >> 8;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Componente Cr de um pixel, centrada em zero (-128 a 127).
+ */
+static inline int calcularCr(int R, int G, int B)
+{
+    return (128 * R - 107 * G - 21 * B) >> 8;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Distância ao quadrado de um pixel até a chave, no espaço da chave.
+ */
+static inline int distanciaChave(const tpPixel *p, const tpChave *chave)
+{
+    if (chave->espaco == ESPACO_CBCR){
+
+        int dcb = calcularCb(p->R, p->G, p->B) - chave->Cb;
+        int dcr = calcularCr(p->R, p->G, p->B) - chave->Cr;
+
+        return dcb * dcb + dcr * dcr;
+    }
+
+    return (p->R - chave->R) * (p->R - chave->R)
+         + (p->G - chave->G) * (p->G - chave->G)
+         + (p->B - chave->B) * (p->B - chave->B);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Distância ao quadrado entre dois pixels, em RGB ou só em (Cb, Cr).
+ */
+static inline int distanciaPixels(const tpPixel *a, const tpPixel *b, int espaco)
+{
+    if (espaco == ESPACO_CBCR){
+
+        int dcb = calcularCb(a->R, a->G, a->B) - calcularCb(b->R, b->G, b->B);
+        int dcr = calcularCr(a->R, a->G, a->B) - calcularCr(b->R, b->G, b->B);
+
+        return dcb * dcb + dcr * dcr;
+    }
+
+    return (a->R - b->R) * (a->R - b->R)
+         + (a->G - b->G) * (a->G - b->G)
+         + (a->B - b->B) * (a->B - b->B);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Canal de maior valor da chave (0 = R, 1 = G, 2 = B); o verde vence empates.
+ */
+static inline int canalDominante(int R, int G, int B)
+{
+    if (G >= R && G >= B) return 1;
+    if (B >= R) return 2;
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Limita o canal `canal` do pixel ao maior dos outros dois (despill).
+ */
+static inline tpPixel removerVazamento(tpPixel p, int canal)
+{
+    unsigned char limite;
+
+    if (canal == 0){
+
+        limite = p.G > p.B ? p.G : p.B;
+        if (p.R > limite) p.R = limite;
+    }
+
+    else if (canal == 1){
+
+        limite = p.R > p.B ? p.R : p.B;
+        if (p.G > limite) p.G = limite;
+    }
+
+    else if (canal == 2){
+
+        limite = p.R > p.G ? p.R : p.G;
+        if (p.B > limite) p.B = limite;
+    }
+
+    return p;
+}
+
+//-----------------------------------------------------------------------------
+
+#ifdef CHROMA_X86
+
+/*
+ * Máscaras de `pshufb` para separar 16 pixels RGB intercalados (48 bytes, em
+ * três registradores de 16) em um registrador por canal.
+ */
+static const signed char desintR[3][16] = {
+    { 0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13}
+};
+
+static const signed char desintG[3][16] = {
+    { 1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14}
+};
+
+static const signed char desintB[3][16] = {
+    { 2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Compõe as imagens de referência de testes/ com o programa dado e compara com
+# as saídas esperadas: os três caminhos de criarImagem() (bandas, --planar e
+# matte com filtro), tolerâncias 0, 10 (com pixels na borda exata) e 441, e
+# dimensões ímpares (foreground 37x23, fundo 41x29). As imagens ficam em P3
+# para que um diff do repositório mostre os valores; `--mmap` só mapeia P6,
+# então usa fundo6.ppm, o mesmo fundo em P6.
+
+PROG=${1:-./chromakey}
+DIR=$(dirname "$0")
+SAIDA=${TMPDIR:-/tmp}/chromakey_teste_$$.ppm
+FALHAS=0
+
+conferir(){
+    esperado=$1
+    fundo=$2
+    shift 2
+
+    if ! "$PROG" "$DIR/frente.ppm" "$DIR/$fundo" "$SAIDA" "$@" --format P3 > /dev/null 2>&1 || ! cmp -s "$SAIDA" "$DIR/$esperado"; then
+
+        echo "  difere de $esperado: $*"
+        FALHAS=$((FALHAS + 1))
+    fi
+}
+
+for tol in 0 10 441; do
+
+    for opcoes in "" "--threads 3" "--simd escalar" "--simd ssse3" "--stream" "--pipeline" "--planar" "--planar --threads 3"; do
+
+        conferir esperado_t$tol.ppm fundo.ppm 0 255 0 $tol $opcoes
+    done
+
+    conferir esperado_t$tol.ppm fundo6.ppm 0 255 0 $tol
+    conferir esperado_t$tol.ppm fundo6.ppm 0 255 0 $tol --mmap
+done
+
+conferir esperado_t10_blur.ppm fundo.ppm 0 255 0 10 --blur 1
+conferir esperado_t10_blur.ppm fundo.ppm 0 255 0 10 --blur 1 --threads 3
+
+rm -f "$SAIDA"
+
+if [ $FALHAS -ne 0 ]; then
+
+    echo "Imagens de referencia: $FALHAS falha(s)."
+    exit 1
+fi
+
+echo "Imagens de referencia: ok"
@@ -0,0 +1,187 @@
+/**
+ * @file fuzzLeitores.c
+ * @brief Alvo de fuzzing dos leitores de cabeçalho e de pixels P3/P6.
+ *
+ * `LLVMFuzzerTestOneInput()` recebe bytes arbitrários como se fossem um
+ * arquivo PPM: lê o cabeçalho com `lerValorCabecalho()` e, se as dimensões
+ * forem pequenas, os pixels com `lerPixels()` (8 bits) ou `lerLinha16()`
+ * (16 bits). Entradas inválidas levam o programa a `exit()`, que aqui volta
+ * para o alvo com `longjmp()`; o que se procura são leituras fora dos
+ * buffers, estouros e travamentos.
+ *
+ * Com `-DCHROMA_LIBFUZZER` e `-fsanitize=fuzzer` (clang), a `main()` é a do
+ * libFuzzer (`make fuzz`). Sem isso, a `main()` abaixo repassa cada arquivo
+ * dado e mutações sorteadas dele ao alvo, sem sanitizadores obrigatórios,
+ * para rodar com o `make test`.
+ *
+ * @author Társis Barreto
+ * @author Isaque Passos
+ */
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PIXELS_FUZZ (1 << 20) /**< Imagens maiores são descartadas após o cabeçalho. */
+#define MUTACOES_FUZZ 2000 /**< Mutações por arquivo na `main()` própria. */
+
+static jmp_buf retornoFuzz;
+
+/**
+ * @brief Substitui `exit()` nos leitores: volta para `LLVMFuzzerTestOneInput()`.
+ */
+static void sairFuzz(int codigo)
+{
+    (void)codigo;
+    longjmp(retornoFuzz, 1);
+}
+
+#define main programaChromakey
+#define exit sairFuzz
+#include "../chromakeyFinal.c"
+#undef exit
+#undef main
+
+int LLVMFuzzerTestOneInput(const uint8_t *dados, size_t tam);
+
+/* Estado da entrada atual, liberado também quando um leitor sai por `sairFuzz()`. */
+static tpBlocos blocosFuzz;
+static tpPixel **linhasFuzz;
+static tpPixel16 *linha16Fuzz;
+static tpLeitor leitorFuzz;
+static FILE *arqFuzz;
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Lê `dados` como um arquivo PPM completo.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *dados, size_t tam)
+{
+    char info[4];
+
+    if (tam == 0) return 0;
+
+    arqFuzz = fmemopen((void *)dados, tam, "rb");
+    if (arqFuzz == NULL) return 0;
+
+    iniciarLeitor(&leitorFuzz, arqFuzz);
+
+    if (setjmp(retornoFuzz) == 0 && fscanf(arqFuzz, "%3s", info) == 1 && (strcmp(info, "P3") == 0 || strcmp(info, "P6") == 0)){
+
+        size_t nCol = lerValorCabecalho(arqFuzz);
+        size_t nLin = lerValorCabecalho(arqFuzz);
+        size_t maxVal = lerValorCabecalho(arqFuzz);
+
+        if (nCol > 0 && nLin > 0 && nCol <= PIXELS_FUZZ / nLin && maxVal > 0 && maxVal <= 65535){
+
+            if (maxVal <= 255){
+
+                linhasFuzz = reservarImagem(&blocosFuzz, nLin, nCol);
+                lerPixels(&leitorFuzz, info, linhasFuzz, nLin, nCol);
+            }
+
+            else{
+
+                linha16Fuzz = (tpPixel16 *)malloc(sizeof(tpPixel16) * nCol);
+
+                if (linha16Fuzz != NULL){
+
+                    for (size_t i = 0; i < nLin; i++) lerLinha16(&leitorFuzz, info, linha16Fuzz, nCol);
+                }
+            }
+        }
+    }
+
+    liberarLeitor(&leitorFuzz);
+    liberarBlocos(&blocosFuzz);
+    free(linhasFuzz);
+    free(linha16Fuzz);
+    linhasFuzz = NULL;
+    linha16Fuzz = NULL;
+    fclose(arqFuzz);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+#ifndef CHROMA_LIBFUZZER
+/**
+ * @brief Repassa cada arquivo e `MUTACOES_FUZZ` mutações dele ao alvo.
+ *
+ * As mutações trocam, inserem ou apagam bytes, cortam o arquivo e trocam
+ * dígitos, sempre com a mesma semente.
+ */
+int main(int argc, char *argv[])
+{
+    unsigned int semente = 12345;
+
+    if (argc < 2){
+
+        printf("Instr. de uso: <prog> arquivo.ppm [...]\n");
+        return 1;
+    }
+
+    for (int a = 1; a < argc; a++){
+
+        FILE *arq = fopen(argv[a], "rb");
+        unsigned char *original, *mutado;
+        long tam;
+
+        if (arq == NULL || fseek(arq, 0, SEEK_END) != 0 || (tam = ftell(arq)) <= 0){
+
+            printf("Erro ao ler %s.\n", argv[a]);
+            return 1;
+        }
+
+        rewind(arq);
+        original = (unsigned char *)malloc((size_t)tam);
+        mutado = (unsigned char *)malloc((size_t)tam + 16);
+
+        if (original == NULL || mutado == NULL || fread(original, 1, (size_t)tam, arq) != (size_t)tam){
+
+            printf("Erro ao ler %s.\n", argv[a]);
+            return 1;
+        }
+
+        fclose(arq);
+        LLVMFuzzerTestOneInput(original, (size_t)tam);
+
+        for (int m = 0; m < MUTACOES_FUZZ; m++){
+
+            size_t n = (size_t)tam;
+            unsigned int sorteio = proximoAleatorio(&semente);
+            size_t pos = proximoAleatorio(&semente) % n;
+
+            memcpy(mutado, original, n);
+
+            switch (sorteio % 5){
+
+                case 0: mutado[pos] = (unsigned char)proximoAleatorio(&semente); break;
+                case 1: mutado[pos] = (unsigned char)("0123456789 #\n-+"[proximoAleatorio(&semente) % 16]); break;
+                case 2: n = pos + 1; break;
+                case 3: memmove(mutado + pos, mutado + pos + 1, n - pos - 1); n--; break;
+                default:{
+
+                    size_t k = 1 + proximoAleatorio(&semente) % 16;
+
+                    memmove(mutado + pos + k, mutado + pos, n - pos);
+                    memset(mutado + pos, "9 #\n"[sorteio >> 8 & 3], k);
+                    n += k;
+                }
+            }
+
+            LLVMFuzzerTestOneInput(mutado, n);
+        }
+
+        free(original);
+        free(mutado);
+    }
+
+    fprintf(stderr, "Fuzzing dos leitores: %d arquivo(s), %d mutacoes cada: ok\n", argc - 1, MUTACOES_FUZZ);
+
+    return 0;
+}
+#endif
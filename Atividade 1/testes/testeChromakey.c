@@ -0,0 +1,683 @@
+/**
+ * @file testeChromakey.c
+ * @brief Testes do Chroma Key que não passam por arquivos de imagem.
+ *
+ * Confere os kernels SSSE3 e AVX2 (8 e 16 bits) contra os escalares, bit a
+ * bit, em linhas sorteadas que passam pelos três caminhos da composição e
+ * pelas tolerâncias extremas (0 e 441); `compor()` sobre imagens inteiras e
+ * as suas validações; os leitores P3/P6 contra valores gravados com espaços,
+ * comentários e sinais variados; e as somas de verificação do PNG. A semente
+ * é fixa, então uma falha se repete da mesma forma. Termina com código 1 se
+ * algo diferir.
+ *
+ * Inclui os dois arquivos do programa para chegar às funções internas (os
+ * kernels de `chromakey.c` são `static`); a `main()` do programa é renomeada.
+ * As imagens de referência em `testes/` são conferidas pelo `make test`.
+ *
+ * @author Társis Barreto
+ * @author Isaque Passos
+ */
+
+#define main programaChromakey
+#include "../chromakeyFinal.c"
+#undef main
+#include "../chromakey.c"
+
+#define RODADAS_TESTE 4000 /**< Linhas sorteadas por kernel. */
+#define COLUNAS_TESTE 150
+#define FALHAS_TESTE 10 /**< Falhas detalhadas por conferência; as demais só são contadas. */
+#define RODADAS_COMPOR 300
+#define LINHAS_COMPOR 31
+#define PASSO_COMPOR 48
+
+tpPixel pixelProximo(tpPixel base, unsigned int *semente);
+int conferirKernels(unsigned int *semente);
+int conferirCompor(unsigned int *semente);
+int conferirKernels16(unsigned int *semente);
+void gravarValorSorteado(FILE *arq, unsigned int v, int sinais, unsigned int *semente);
+int conferirLeitura(unsigned int *semente);
+int conferirSomas(unsigned int *semente);
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Pixel aleatório igual a `base` ou a até 3 unidades dela por canal.
+ *
+ * Perto da chave (ou da placa) as distâncias ficam pequenas e caem com
+ * frequência exatamente na tolerância, o caminho da média.
+ */
+tpPixel pixelProximo(tpPixel base, unsigned int *semente)
+{
+    unsigned int sorteio = proximoAleatorio(semente);
+    tpPixel p;
+    int canais[3] = {base.R, base.G, base.B};
+
+    for (int c = 0; c < 3; c++){
+
+        if (sorteio % 3 != 0){
+
+            canais[c] += (int)((sorteio >> (4 + 3 * c)) % 7) - 3;
+            canais[c] = canais[c] < 0 ? 0 : canais[c] > 255 ? 255 : canais[c];
+        }
+    }
+
+    p.R = (unsigned char)canais[0];
+    p.G = (unsigned char)canais[1];
+    p.B = (unsigned char)canais[2];
+
+    return p;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Confere os kernels SSSE3 e AVX2 de 8 bits contra os escalares, bit a bit.
+ *
+ * Cada rodada sorteia largura (de 1 a `COLUNAS_TESTE`, cobrindo as caudas
+ * escalares), chave, espaço de cor, despill e tolerância (0, 441, pequena,
+ * qualquer ou igual à distância de um dos pixels) e alterna entre chave de
+ * cor e matte de diferença. Também confere a composição no lugar
+ * (`saida == back`), que `compor()` permite. Devolve o número de falhas.
+ */
+int conferirKernels(unsigned int *semente)
+{
+    tpKernelLinha kernels[2];
+    tpKernelDiferenca kernelsDif[2];
+    const char *nomes[2];
+    int nKernels = 0, falhas = 0;
+    tpPixel back[COLUNAS_TESTE], fore[COLUNAS_TESTE], placa[COLUNAS_TESTE];
+    tpPixel esperado[COLUNAS_TESTE], obtido[COLUNAS_TESTE];
+
+#ifdef CHROMA_X86
+    if (__builtin_cpu_supports("ssse3")){
+
+        kernels[nKernels] = comporLinhaSSSE3;
+        kernelsDif[nKernels] = comporDiferencaSSSE3;
+        nomes[nKernels++] = "ssse3";
+    }
+
+    if (__builtin_cpu_supports("avx2")){
+
+        kernels[nKernels] = comporLinhaAVX2;
+        kernelsDif[nKernels] = comporDiferencaAVX2;
+        nomes[nKernels++] = "avx2";
+    }
+#endif
+
+    for (int rodada = 0; rodada < RODADAS_TESTE; rodada++){
+
+        size_t nCol = 1 + proximoAleatorio(semente) % COLUNAS_TESTE;
+        unsigned int sorteio = proximoAleatorio(semente);
+        int diferenca = rodada % 2;
+        tpPixel cor;
+        tpChave chave;
+
+        cor.R = (unsigned char)proximoAleatorio(semente);
+        cor.G = (unsigned char)proximoAleatorio(semente);
+        cor.B = (unsigned char)proximoAleatorio(semente);
+
+        chave.R = cor.R;
+        chave.G = cor.G;
+        chave.B = cor.B;
+        chave.Cb = calcularCb(cor.R, cor.G, cor.B);
+        chave.Cr = calcularCr(cor.R, cor.G, cor.B);
+        chave.espaco = sorteio & 1 ? ESPACO_CBCR : ESPACO_RGB;
+        chave.despill = !diferenca && (sorteio & 2) ? canalDominante(cor.R, cor.G, cor.B) : -1;
+
+        for (size_t j = 0; j < nCol; j++){
+
+            unsigned int modo = proximoAleatorio(semente) % 3;
+
+            back[j].R = (unsigned char)proximoAleatorio(semente);
+            back[j].G = (unsigned char)proximoAleatorio(semente);
+            back[j].B = (unsigned char)proximoAleatorio(semente);
+            placa[j].R = (unsigned char)proximoAleatorio(semente);
+            placa[j].G = (unsigned char)proximoAleatorio(semente);
+            placa[j].B = (unsigned char)proximoAleatorio(semente);
+
+            if (modo == 0){
+
+                fore[j].R = (unsigned char)proximoAleatorio(semente);
+                fore[j].G = (unsigned char)proximoAleatorio(semente);
+                fore[j].B = (unsigned char)proximoAleatorio(semente);
+            }
+
+            else fore[j] = pixelProximo(diferenca ? placa[j] : cor, semente);
+        }
+
+        switch ((sorteio >> 2) % 5){
+
+            case 0: chave.tolerancia = 0; break;
+            case 1: chave.tolerancia = 441 * 441; break;
+            case 2: chave.tolerancia = (int)(1 + (sorteio >> 8) % 8) * (int)(1 + (sorteio >> 8) % 8); break;
+            case 3: chave.tolerancia = (int)((sorteio >> 8) % 442) * (int)((sorteio >> 8) % 442); break;
+            default:{
+
+                size_t j = (sorteio >> 8) % nCol;
+
+                chave.tolerancia = diferenca ? distanciaPixels(&fore[j], &placa[j], chave.espaco) : distanciaChave(&fore[j], &chave);
+            }
+        }
+
+        if (diferenca) comporDiferencaEscalar(esperado, back, fore, placa, nCol, &chave);
+        else comporLinhaEscalar(esperado, back, fore, nCol, &chave);
+
+        for (int k = 0; k < nKernels; k++){
+
+            for (int noLugar = 0; noLugar < 2; noLugar++){
+
+                const tpPixel *fundo = back;
+
+                if (noLugar){
+
+                    memcpy(obtido, back, sizeof(tpPixel) * nCol);
+                    fundo = obtido;
+                }
+
+                if (diferenca) kernelsDif[k](obtido, fundo, fore, placa, nCol, &chave);
+                else kernels[k](obtido, fundo, fore, nCol, &chave);
+
+                if (memcmp(obtido, esperado, sizeof(tpPixel) * nCol) != 0){
+
+                    if (falhas < FALHAS_TESTE) printf("  kernel %s%s difere do escalar: rodada %d, %zu colunas, tolerancia^2 %d, %s%s%s\n",
+                           nomes[k], noLugar ? " (no lugar)" : "", rodada, nCol, chave.tolerancia,
+                           chave.espaco == ESPACO_CBCR ? "cbcr" : "rgb", diferenca ? ", diferenca" : "",
+                           chave.despill >= 0 ? ", despill" : "");
+                    falhas++;
+                }
+            }
+        }
+    }
+
+    printf("Kernels de 8 bits (%d variante(s) SIMD, %d rodadas): %s\n", nKernels, RODADAS_TESTE, falhas ? "FALHOU" : "ok");
+
+    return falhas;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Confere `compor()` sobre imagens inteiras e as suas validações.
+ *
+ * Imagens de dimensões sorteadas (ímpares inclusive), com `passo` maior que
+ * `nCol` e foreground maior ou menor que o fundo, devem sair iguais ao kernel
+ * escalar aplicado linha a linha, em todos os níveis SIMD; tolerâncias fora
+ * de 0..441 devem dar o mesmo que os extremos. `passo` menor que `nCol`,
+ * ponteiros nulos e saída de tamanho errado devem ser rejeitados.
+ */
+int conferirCompor(unsigned int *semente)
+{
+    static tpPixel fore[LINHAS_COMPOR * PASSO_COMPOR], back[LINHAS_COMPOR * PASSO_COMPOR];
+    static tpPixel esperado[LINHAS_COMPOR * PASSO_COMPOR], obtido[LINHAS_COMPOR * PASSO_COMPOR];
+    static const int tolerancias[5] = {-5, 0, 7, 441, 500};
+    int falhas = 0;
+    tpImagem imgFore, imgBack, imgSaida;
+    tpPixel cor = {0, 255, 0};
+
+    for (int rodada = 0; rodada < RODADAS_COMPOR; rodada++){
+
+        unsigned int sorteio = proximoAleatorio(semente);
+        int tol = sorteio % 6 == 5 ? (int)((sorteio >> 8) % 442) : tolerancias[sorteio % 6];
+        tpOpcoesChave opcoes;
+        tpChave chave;
+        size_t nLin, nCol;
+
+        memset(&imgBack, 0, sizeof(imgBack));
+        memset(&imgFore, 0, sizeof(imgFore));
+        memset(&opcoes, 0, sizeof(opcoes));
+
+        imgBack.nLin = 1 + proximoAleatorio(semente) % LINHAS_COMPOR;
+        imgBack.nCol = 1 + proximoAleatorio(semente) % (PASSO_COMPOR - 3);
+        imgBack.passo = imgBack.nCol + proximoAleatorio(semente) % 4;
+        imgBack.pixels = back;
+
+        imgFore.nLin = 1 + proximoAleatorio(semente) % LINHAS_COMPOR;
+        imgFore.nCol = 1 + proximoAleatorio(semente) % (PASSO_COMPOR - 3);
+        imgFore.passo = imgFore.nCol + proximoAleatorio(semente) % 4;
+        imgFore.pixels = fore;
+
+        imgSaida = imgBack;
+        imgSaida.pixels = obtido;
+
+        cor.R = (unsigned char)proximoAleatorio(semente);
+        cor.G = (unsigned char)proximoAleatorio(semente);
+        cor.B = (unsigned char)proximoAleatorio(semente);
+
+        for (size_t k = 0; k < LINHAS_COMPOR * PASSO_COMPOR; k++){
+
+            back[k].R = (unsigned char)proximoAleatorio(semente);
+            back[k].G = (unsigned char)proximoAleatorio(semente);
+            back[k].B = (unsigned char)proximoAleatorio(semente);
+            fore[k] = pixelProximo(cor, semente);
+
+            if (proximoAleatorio(semente) % 3 == 0) fore[k].B = (unsigned char)proximoAleatorio(semente);
+        }
+
+        opcoes.espaco = sorteio & 0x100 ? CHROMA_ESPACO_CBCR : CHROMA_ESPACO_RGB;
+        opcoes.despill = (sorteio & 0x200) != 0;
+        opcoes.placa = NULL;
+
+        chave.R = cor.R;
+        chave.G = cor.G;
+        chave.B = cor.B;
+        chave.Cb = calcularCb(cor.R, cor.G, cor.B);
+        chave.Cr = calcularCr(cor.R, cor.G, cor.B);
+        chave.espaco = opcoes.espaco;
+        chave.despill = opcoes.despill ? canalDominante(cor.R, cor.G, cor.B) : -1;
+        chave.tolerancia = tol < 0 ? 0 : tol > 441 ? 441 * 441 : tol * tol;
+
+        nLin = imgFore.nLin < imgBack.nLin ? imgFore.nLin : imgBack.nLin;
+        nCol = imgFore.nCol < imgBack.nCol ? imgFore.nCol : imgBack.nCol;
+
+        for (size_t i = 0; i < imgBack.nLin; i++){
+
+            memcpy(esperado + i * imgBack.passo, back + i * imgBack.passo, sizeof(tpPixel) * imgBack.nCol);
+
+            if (i < nLin) comporLinhaEscalar(esperado + i * imgBack.passo, back + i * imgBack.passo, fore + i * imgFore.passo, nCol, &chave);
+        }
+
+        for (int simd = CHROMA_SIMD_AUTO; simd <= CHROMA_SIMD_AVX2; simd++){
+
+            int retorno, certo = 1;
+
+            opcoes.simd = simd;
+            memset(obtido, 0, sizeof(obtido));
+            retorno = compor(&imgFore, &imgBack, cor, tol, &imgSaida, &opcoes);
+
+            for (size_t i = 0; i < imgBack.nLin && certo; i++)
+                certo = memcmp(obtido + i * imgBack.passo, esperado + i * imgBack.passo, sizeof(tpPixel) * imgBack.nCol) == 0;
+
+            if (retorno != CHROMA_OK || !certo){
+
+                if (falhas < FALHAS_TESTE) printf("  compor() difere do escalar: rodada %d, simd %d, fundo %zux%zu (passo %zu), foreground %zux%zu (passo %zu), tolerancia %d\n",
+                       rodada, simd, imgBack.nCol, imgBack.nLin, imgBack.passo, imgFore.nCol, imgFore.nLin, imgFore.passo, tol);
+                falhas++;
+            }
+        }
+    }
+
+    /* Validações: passo menor que a largura, saída de outro tamanho e ponteiro nulo. */
+    for (int caso = 0; caso < 5; caso++){
+
+        tpImagem *alterada[4] = {&imgFore, &imgBack, &imgSaida, &imgSaida};
+        int esperadoRetorno = caso == 4 ? CHROMA_ERRO_PARAMETRO : CHROMA_ERRO_DIMENSAO;
+
+        imgFore.pixels = fore;
+        imgFore.nLin = imgFore.nCol = imgFore.passo = 5;
+        imgBack = imgSaida = imgFore;
+        imgBack.pixels = back;
+        imgSaida.pixels = obtido;
+
+        if (caso < 3) alterada[caso]->passo = 4;
+        else if (caso == 3) alterada[caso]->nCol = 4;
+
+        if (compor(&imgFore, caso == 4 ? NULL : &imgBack, cor, 10, &imgSaida, NULL) != esperadoRetorno){
+
+            printf("  compor() aceitou a entrada invalida %d\n", caso);
+            falhas++;
+        }
+    }
+
+    /* Tolerância acima de 441 vale 441: o canto oposto do cubo à chave continua foreground. */
+    cor.R = 0;
+    cor.G = 255;
+    cor.B = 0;
+    fore[0].R = fore[0].B = 255;
+    fore[0].G = 0;
+    imgFore.nLin = imgFore.nCol = imgFore.passo = 1;
+    imgBack = imgSaida = imgFore;
+    imgBack.pixels = back;
+    imgSaida.pixels = obtido;
+
+    if (compor(&imgFore, &imgBack, cor, 500, &imgSaida, NULL) != CHROMA_OK || memcmp(obtido, fore, sizeof(tpPixel)) != 0){
+
+        printf("  compor() nao limitou a tolerancia a 441\n");
+        falhas++;
+    }
+
+    printf("compor() (%d rodadas e validacoes): %s\n", RODADAS_COMPOR, falhas ? "FALHOU" : "ok");
+
+    return falhas;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Confere o kernel AVX2 de 16 bits contra o escalar, com maxval 65535.
+ *
+ * A chave e a tolerância ao quadrado vão em um `tpChave16`, como em `compor()`.
+ */
+int conferirKernels16(unsigned int *semente)
+{
+    tpPixel16 back[COLUNAS_TESTE], fore[COLUNAS_TESTE], esperado[COLUNAS_TESTE], obtido[COLUNAS_TESTE];
+    tpChave16 k;
+    int falhas = 0;
+
+#ifdef CHROMA_X86
+    if (!__builtin_cpu_supports("avx2")){
+
+        printf("Kernel de 16 bits: sem AVX2, nada a conferir\n");
+        return 0;
+    }
+
+    for (int rodada = 0; rodada < RODADAS_TESTE; rodada++){
+
+        size_t nCol = 1 + proximoAleatorio(semente) % COLUNAS_TESTE;
+        unsigned int sorteio = proximoAleatorio(semente);
+
+        k.R = (unsigned short)proximoAleatorio(semente);
+        k.G = (unsigned short)proximoAleatorio(semente);
+        k.B = (unsigned short)proximoAleatorio(semente);
+
+        for (size_t j = 0; j < nCol; j++){
+
+            back[j].R = (unsigned short)proximoAleatorio(semente);
+            back[j].G = (unsigned short)proximoAleatorio(semente);
+            back[j].B = (unsigned short)proximoAleatorio(semente);
+
+            if (proximoAleatorio(semente) % 3 == 0){
+
+                fore[j].R = (unsigned short)proximoAleatorio(semente);
+                fore[j].G = (unsigned short)proximoAleatorio(semente);
+                fore[j].B = (unsigned short)proximoAleatorio(semente);
+            }
+
+            else{
+
+                /* Perto da chave: até 300 unidades por canal, sem sair de 0..65535. */
+                int d[3];
+
+                for (int c = 0; c < 3; c++) d[c] = (int)(proximoAleatorio(semente) % 601) - 300;
+
+                fore[j].R = (unsigned short)(k.R + d[0] < 0 ? 0 : k.R + d[0] > 65535 ? 65535 : k.R + d[0]);
+                fore[j].G = (unsigned short)(k.G + d[1] < 0 ? 0 : k.G + d[1] > 65535 ? 65535 : k.G + d[1]);
+                fore[j].B = (unsigned short)(k.B + d[2] < 0 ? 0 : k.B + d[2] > 65535 ? 65535 : k.B + d[2]);
+            }
+        }
+
+        if (sorteio % 4 == 0) k.tolerancia = 0;
+        else if (sorteio % 4 == 1) k.tolerancia = 113512LL * 113512LL; /* diagonal do cubo de 16 bits */
+        else if (sorteio % 4 == 2) k.tolerancia = (long long)((sorteio >> 4) % 520) * ((sorteio >> 4) % 520);
+        else{
+
+            size_t j = (sorteio >> 4) % nCol;
+            long long dR = fore[j].R - k.R, dG = fore[j].G - k.G, dB = fore[j].B - k.B;
+
+            k.tolerancia = dR * dR + dG * dG + dB * dB;
+        }
+
+        comporLinha16Escalar(esperado, back, fore, nCol, &k);
+        comporLinha16AVX2(obtido, back, fore, nCol, &k);
+
+        if (memcmp(obtido, esperado, sizeof(tpPixel16) * nCol) != 0){
+
+            if (falhas < FALHAS_TESTE) printf("  kernel avx2 de 16 bits difere do escalar: rodada %d, %zu colunas, tolerancia^2 %lld\n", rodada, nCol, k.tolerancia);
+            falhas++;
+        }
+    }
+
+    printf("Kernel de 16 bits (avx2, %d rodadas): %s\n", RODADAS_TESTE, falhas ? "FALHOU" : "ok");
+#else
+    (void)semente;
+    (void)back;
+    (void)fore;
+    (void)esperado;
+    (void)obtido;
+    (void)k;
+    printf("Kernel de 16 bits: sem AVX2, nada a conferir\n");
+#endif
+
+    return falhas;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Grava em `arq` o valor `v` de um P3 precedido de um separador sorteado.
+ *
+ * Os separadores incluem tabulações, `\r\n`, espaços repetidos e comentários;
+ * com `sinais`, alguns valores levam `+`, que só o leitor de pixels aceita.
+ * Ambos tiram o leitor do caminho rápido de `lerCanaisP3()`.
+ */
+void gravarValorSorteado(FILE *arq, unsigned int v, int sinais, unsigned int *semente)
+{
+    static const char *separadores[8] = {" ", "\n", " ", "\n", "\t", "\r\n", "   ", " # comentario 12 34\n"};
+    unsigned int sorteio = proximoAleatorio(semente);
+
+    fputs(separadores[sorteio % 8], arq);
+    fprintf(arq, sinais && sorteio % 64 == 0 ? "+%u" : "%u", v);
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Confere os leitores de cabeçalho e de pixels (P3 e P6, 8 e 16 bits).
+ *
+ * Cada caso grava num arquivo temporário valores sorteados com separadores
+ * variados, em volume maior que `TAM_BUFFER_LEITURA` para cruzar as recargas
+ * do buffer, e os lê de volta em linhas de largura sorteada. O escritor P3 é
+ * conferido pela ida e volta pelo leitor. Devolve o número de falhas.
+ */
+int conferirLeitura(unsigned int *semente)
+{
+    size_t nValores = 3 * (TAM_BUFFER_LEITURA / 4 + 12345);
+    unsigned short *valores = (unsigned short *)malloc(sizeof(unsigned short) * nValores);
+    unsigned short *lidos = (unsigned short *)malloc(sizeof(unsigned short) * nValores);
+    const char *nomes[6] = {"cabecalho", "P3 8 bits", "P3 16 bits", "P6 8 bits", "P6 16 bits", "escritor P3"};
+    char infoOriginal[4];
+    int falhas = 0;
+
+    if (valores == NULL || lidos == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    strcpy(infoOriginal, infoS);
+
+    for (int caso = 0; caso < 6; caso++){
+
+        FILE *arq = tmpfile();
+        tpLeitor leitor;
+        size_t n = caso == 0 ? 1000 : nValores;
+        int bits16 = caso == 2 || caso == 4;
+        int certo = 1;
+
+        if (arq == NULL){
+
+            printf("Erro ao criar arquivo temporario.\n");
+            exit(1);
+        }
+
+        for (size_t k = 0; k < n; k++) valores[k] = (unsigned short)(bits16 ? proximoAleatorio(semente) : proximoAleatorio(semente) & 0xFF);
+
+        if (caso <= 2){
+
+            for (size_t k = 0; k < n; k++) gravarValorSorteado(arq, valores[k], caso != 0, semente);
+            fputc('\n', arq);
+        }
+
+        else if (caso <= 4){
+
+            for (size_t k = 0; k < n; k++){
+
+                if (bits16) fputc(valores[k] >> 8, arq);
+                fputc(valores[k] & 0xFF, arq);
+            }
+        }
+
+        else{
+
+            tpEscritor escritor;
+            tpPixel pixels[COLUNAS_TESTE];
+            size_t k = 0;
+
+            strcpy(infoS, "P3");
+            iniciarEscritor(&escritor, arq);
+
+            while (k < n){
+
+                size_t nCol = 1 + proximoAleatorio(semente) % COLUNAS_TESTE;
+
+                if (nCol > (n - k) / 3) nCol = (n - k) / 3;
+                if (nCol == 0) break;
+
+                for (size_t j = 0; j < nCol; j++){
+
+                    pixels[j].R = (unsigned char)valores[k + 3 * j];
+                    pixels[j].G = (unsigned char)valores[k + 3 * j + 1];
+                    pixels[j].B = (unsigned char)valores[k + 3 * j + 2];
+                }
+
+                escreverLinha(&escritor, pixels, nCol);
+                k += 3 * nCol;
+            }
+
+            liberarEscritor(&escritor);
+            n = k;
+        }
+
+        rewind(arq);
+
+        if (caso == 0){
+
+            for (size_t k = 0; k < n; k++) lidos[k] = (unsigned short)lerValorCabecalho(arq);
+        }
+
+        else{
+
+            size_t k = 0;
+
+            iniciarLeitor(&leitor, arq);
+
+            while (k < n){
+
+                size_t nCol = 1 + proximoAleatorio(semente) % COLUNAS_TESTE;
+
+                if (nCol > (n - k) / 3) nCol = (n - k) / 3;
+
+                if (bits16){
+
+                    tpPixel16 linha[COLUNAS_TESTE];
+
+                    lerLinha16(&leitor, caso == 2 ? "P3" : "P6", linha, nCol);
+
+                    for (size_t j = 0; j < nCol; j++){
+
+                        lidos[k++] = linha[j].R;
+                        lidos[k++] = linha[j].G;
+                        lidos[k++] = linha[j].B;
+                    }
+                }
+
+                else{
+
+                    tpPixel linha[COLUNAS_TESTE];
+
+                    lerLinha(&leitor, caso == 3 ? "P6" : "P3", linha, nCol);
+
+                    for (size_t j = 0; j < nCol; j++){
+
+                        lidos[k++] = linha[j].R;
+                        lidos[k++] = linha[j].G;
+                        lidos[k++] = linha[j].B;
+                    }
+                }
+            }
+
+            liberarLeitor(&leitor);
+        }
+
+        fclose(arq);
+
+        for (size_t k = 0; k < n && certo; k++){
+
+            if (lidos[k] != valores[k]){
+
+                printf("  %s: valor %zu lido como %u, esperado %u\n", nomes[caso], k, lidos[k], valores[k]);
+                certo = 0;
+                falhas++;
+            }
+        }
+    }
+
+    strcpy(infoS, infoOriginal);
+    free(valores);
+    free(lidos);
+
+    printf("Leitores e escritor PPM (%zu valores por caso): %s\n", nValores, falhas ? "FALHOU" : "ok");
+
+    return falhas;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Confere o CRC-32 e a combinação de Adler-32 usados pela saída PNG.
+ *
+ * O CRC do chunk IEND vazio tem valor conhecido; o Adler-32 de um buffer
+ * partido em dois pontos sorteados, combinado, deve ser o do buffer inteiro.
+ */
+int conferirSomas(unsigned int *semente)
+{
+    size_t tam = 200000;
+    unsigned char *dados = (unsigned char *)malloc(tam);
+    int falhas = 0;
+
+    if (dados == NULL){
+
+        printf("Erro ao alocar.\n");
+        exit(1);
+    }
+
+    iniciarTabelasPNG();
+
+    if (~atualizarCRC(0xFFFFFFFFu, (const unsigned char *)"IEND", 4) != 0xAE426082u){
+
+        printf("  CRC-32 de IEND incorreto\n");
+        falhas++;
+    }
+
+    for (size_t k = 0; k < tam; k++) dados[k] = (unsigned char)(proximoAleatorio(semente) % 7 == 0 ? 0xFF : proximoAleatorio(semente));
+
+    for (int rodada = 0; rodada < 200; rodada++){
+
+        size_t n = proximoAleatorio(semente) % (tam + 1);
+        size_t corte = n > 0 ? proximoAleatorio(semente) % (n + 1) : 0;
+        unsigned int inteiro = calcularAdler(dados, n);
+        unsigned int combinado = combinarAdler(calcularAdler(dados, corte), calcularAdler(dados + corte, n - corte), n - corte);
+
+        if (inteiro != combinado){
+
+            printf("  Adler-32 combinado difere: %zu bytes cortados em %zu\n", n, corte);
+            falhas++;
+        }
+    }
+
+    free(dados);
+
+    printf("Somas de verificacao do PNG: %s\n", falhas ? "FALHOU" : "ok");
+
+    return falhas;
+}
+
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Executa todas as conferências e devolve o código de saída.
+ */
+int main()
+{
+    unsigned int semente = 12345;
+    int falhas = 0;
+
+    falhas += conferirKernels(&semente);
+    falhas += conferirCompor(&semente);
+    falhas += conferirKernels16(&semente);
+    falhas += conferirLeitura(&semente);
+    falhas += conferirSomas(&semente);
+
+    printf(falhas ? "Testes: %d falha(s).\n" : "Testes: tudo certo.\n", falhas);
+
+    return falhas ? 1 : 0;
+}
@@ -16,6 +16,7 @@
 
 // Inclusão de Bibliotecas Essenciais
 // ------------------------------------
+#define GL_GLEXT_PROTOTYPES /**< Expõe os protótipos dos buffers de vértices (OpenGL 1.5).*/
 #include <GL/glut.h> /**< Biblioteca principal. Fornece inúmeras funções para se trabalhar com OpenGL.*/
 #include <math.h> /**< Biblioteca matemática, Útil para manipular angulações, proporções e etc.*/
 #include <stdbool.h> /**< Biblioteca que implementa o tipo booleano.*/
@@ -43,6 +44,14 @@
 #define COR_CONTORNO (tpCor){110, 90, 60}
 // ------------------------------------
 
+// Definição de macros da geometria guardada na GPU
+// ------------------------------------
+#define MAX_PARTES 24
+#define MAX_PONTOS_PARTE 64
+#define MAX_ELIPSES 32
+#define MAX_SEGMENTOS_ELIPSE 128
+// ------------------------------------
+
 // Definição de macros para conversão de graus e radianos
 // ------------------------------------
 #define _G * (180.0 / M_PI)
@@ -93,6 +102,46 @@ typedef struct Limite {
     float max;
 } tpLimite;
 
+// ------------------------------------
+
+/**
+ * @struct GeometriaVBO
+ * @brief Os vértices (e as cores do gradiente) de uma parte do corpo, guardados na GPU.
+ *
+ * A parte é identificada pelo seu vetor de pontos. `sombra` e `cores` guardam
+ * o que já foi enviado aos buffers, para que só os vértices movidos por
+ * ligarPartes() sejam reenviados a cada quadro.
+ */
+typedef struct GeometriaVBO {
+
+    const tpPonto2D *pontos;
+    int numPontos;
+    GLuint vboPontos;
+    GLuint vboCores; /**< 0 enquanto a parte só foi desenhada com cor sólida. */
+    tpPonto2D sombra[MAX_PONTOS_PARTE];
+    tpCor cores[MAX_PONTOS_PARTE];
+} tpGeometriaVBO;
+
+// ------------------------------------
+
+/**
+ * @struct ElipseVBO
+ * @brief Os vértices de uma elipse já calculada, guardados na GPU.
+ *
+ * As elipses do rosto são sempre as mesmas, então cada combinação de
+ * parâmetros é calculada e enviada uma única vez.
+ */
+typedef struct ElipseVBO {
+
+    float centroX;
+    float centroY;
+    float raioX;
+    float raioY;
+    float anguloInclinacao;
+    int segmentos;
+    GLuint vbo;
+} tpElipseVBO;
+
 //-----------------------------------------------------------------------------
 // Protótipos das Funções
 // ------------------------
@@ -101,6 +150,11 @@ void desenharColorP(tpPonto2D pontos[], int numPontos, tpCor cor);
 void desenharPG(tpPonto2D pontos[], int numPontos, tpCor cor1, tpCor cor2, float inicioGradiente, float fimGradiente);
 void desenharOutline(tpPonto2D pontos[], int numPontos, tpCor cor);
 void desenharElipse(float centroX, float centroY, float raioX, float raioY, int segmentos, tpCor cor, float anguloInclinacao);
+tpGeometriaVBO *obterGeometria(const tpPonto2D pontos[], int numPontos);
+void atualizarGeometria(tpGeometriaVBO *geometria, const tpCor cores[]);
+void desenharGeometria(const tpGeometriaVBO *geometria, bool comCores);
+tpElipseVBO *obterElipse(float centroX, float centroY, float raioX, float raioY, int segmentos, float anguloInclinacao);
+void liberarGeometrias(void);
 void desenharLinhaReta(float x1, float y1, float x2, float y2, tpCor cor, float espessura);
 void desenharLinhaCurva(float centroX, float centroY, float largura, float altura, int segmentos, tpCor cor);
 void desenharFeaturesRosto(void);
@@ -208,6 +262,12 @@ tpLimite limEscalaGroot = {0.7f, 2.3f};
 // PARA BACKGROUND
 GLuint texturaID;
 
+// GEOMETRIA NA GPU -----------------------------------------------------------------------------
+tpGeometriaVBO geometrias[MAX_PARTES];
+int numGeometrias = 0;
+tpElipseVBO elipses[MAX_ELIPSES];
+int numElipses = 0;
+
 //-----------------------------------------------------------------------------
 
 /**
@@ -573,8 +633,17 @@ void definirCor(unsigned char r, unsigned char g, unsigned char b){
  */
 void desenharColorP(tpPonto2D pontos[], int numPontos, tpCor cor){
 
+    tpGeometriaVBO *geometria = obterGeometria(pontos, numPontos);
+
     definirCor(cor.r, cor.g, cor.b);
 
+    if (geometria != NULL) {
+
+        atualizarGeometria(geometria, NULL);
+        desenharGeometria(geometria, false);
+        return;
+    }
+
     glBegin(GL_POLYGON);
 
     for (int i = 0; i < numPontos; i++){
@@ -597,6 +666,8 @@ void desenharColorP(tpPonto2D pontos[], int numPontos, tpCor cor){
  */
 void desenharPG(tpPonto2D pontos[], int numPontos, tpCor cor1, tpCor cor2, float inicioGradiente, float fimGradiente) {
 
+    tpGeometriaVBO *geometria = obterGeometria(pontos, numPontos);
+    tpCor cores[MAX_PONTOS_PARTE];
 
     float yMin = pontos[0].y, yMax = pontos[0].y;
 
@@ -606,7 +677,7 @@ void desenharPG(tpPonto2D pontos[], int numPontos, tpCor cor1, tpCor cor2, float
         if (pontos[i].y > yMax) yMax = pontos[i].y;
     }
 
-    glBegin(GL_POLYGON);
+    if (geometria == NULL) glBegin(GL_POLYGON);
 
     for (int i = 0; i < numPontos; i++) {
 
@@ -628,10 +699,22 @@ void desenharPG(tpPonto2D pontos[], int numPontos, tpCor cor1, tpCor cor2, float
         unsigned char g = cor1.g + fator * (cor2.g - cor1.g);
         unsigned char b = cor1.b + fator * (cor2.b - cor1.b);
 
+        if (geometria != NULL) {
+
+            cores[i] = (tpCor){r, g, b};
+            continue;
+        }
+
         glColor3ub(r, g, b);
         glVertex2f(pontos[i].x, pontos[i].y);
     }
 
+    if (geometria != NULL) {
+
+        atualizarGeometria(geometria, cores);
+        desenharGeometria(geometria, true);
+        return;
+    }
 
     glEnd();
 }
@@ -669,10 +752,23 @@ void desenharOutline(tpPonto2D pontos[], int numPontos, tpCor cor){
  */
 void desenharElipse(float centroX, float centroY, float raioX, float raioY, int segmentos, tpCor cor, float anguloInclinacao){
 
-    anguloInclinacao = anguloInclinacao _R;
+    tpElipseVBO *elipse = obterElipse(centroX, centroY, raioX, raioY, segmentos, anguloInclinacao);
 
     definirCor(cor.r, cor.g, cor.b);
 
+    if (elipse != NULL) {
+
+        glBindBuffer(GL_ARRAY_BUFFER, elipse->vbo);
+        glVertexPointer(2, GL_FLOAT, 0, (const GLvoid *)0);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, segmentos + 2);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    anguloInclinacao = anguloInclinacao _R;
+
     glBegin(GL_TRIANGLE_FAN);
     glVertex2f(centroX, centroY);
 
@@ -691,6 +787,215 @@ void desenharElipse(float centroX, float centroY, float raioX, float raioY, int
     glEnd();
 }
 
+//-----------------------------------------------------------------------------
+/**
+ * @brief Procura (ou cria, no primeiro desenho) a geometria de uma parte na GPU.
+ *
+ * Na criação, todos os pontos são enviados de uma vez a um buffer de vértices.
+ * Retorna NULL se a parte não couber na tabela; nesse caso, o desenho segue
+ * pelo modo imediato.
+ *
+ * @param pontos Vetor de pontos da parte, que também a identifica.
+ * @param numPontos Número de pontos no vetor.
+ * @return tpGeometriaVBO* Geometria da parte, ou NULL.
+ */
+tpGeometriaVBO *obterGeometria(const tpPonto2D pontos[], int numPontos){
+
+    for (int i = 0; i < numGeometrias; i++){
+
+        if (geometrias[i].pontos == pontos && geometrias[i].numPontos == numPontos) return &geometrias[i];
+    }
+
+    if (numGeometrias == MAX_PARTES || numPontos > MAX_PONTOS_PARTE) return NULL;
+
+    tpGeometriaVBO *geometria = &geometrias[numGeometrias++];
+
+    geometria->pontos = pontos;
+    geometria->numPontos = numPontos;
+    geometria->vboCores = 0;
+
+    for (int i = 0; i < numPontos; i++) geometria->sombra[i] = pontos[i];
+
+    glGenBuffers(1, &geometria->vboPontos);
+    glBindBuffer(GL_ARRAY_BUFFER, geometria->vboPontos);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(tpPonto2D) * numPontos, geometria->sombra, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return geometria;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @brief Reenvia à GPU só os vértices (e cores) que mudaram desde o último quadro.
+ *
+ * Compara os pontos atuais com a cópia enviada e atualiza, com uma única
+ * chamada, o trecho entre o primeiro e o último vértice alterado. Em geral
+ * são só as articulações recalculadas por ligarPartes().
+ *
+ * @param geometria Geometria da parte.
+ * @param cores Cores do gradiente de cada vértice, ou NULL para cor sólida.
+ */
+void atualizarGeometria(tpGeometriaVBO *geometria, const tpCor cores[]){
+
+    int primeiro = geometria->numPontos, ultimo = -1;
+
+    for (int i = 0; i < geometria->numPontos; i++){
+
+        if (geometria->sombra[i].x != geometria->pontos[i].x || geometria->sombra[i].y != geometria->pontos[i].y){
+
+            geometria->sombra[i] = geometria->pontos[i];
+            if (i < primeiro) primeiro = i;
+            ultimo = i;
+        }
+    }
+
+    if (ultimo >= 0){
+
+        glBindBuffer(GL_ARRAY_BUFFER, geometria->vboPontos);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(tpPonto2D) * primeiro, sizeof(tpPonto2D) * (ultimo - primeiro + 1), &geometria->sombra[primeiro]);
+    }
+
+    if (cores == NULL) {
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    // As cores só são enviadas inteiras na primeira vez; depois, como os pontos.
+    if (geometria->vboCores == 0){
+
+        for (int i = 0; i < geometria->numPontos; i++) geometria->cores[i] = cores[i];
+
+        glGenBuffers(1, &geometria->vboCores);
+        glBindBuffer(GL_ARRAY_BUFFER, geometria->vboCores);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(tpCor) * geometria->numPontos, geometria->cores, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    primeiro = geometria->numPontos;
+    ultimo = -1;
+
+    for (int i = 0; i < geometria->numPontos; i++){
+
+        if (geometria->cores[i].r != cores[i].r || geometria->cores[i].g != cores[i].g || geometria->cores[i].b != cores[i].b){
+
+            geometria->cores[i] = cores[i];
+            if (i < primeiro) primeiro = i;
+            ultimo = i;
+        }
+    }
+
+    if (ultimo >= 0){
+
+        glBindBuffer(GL_ARRAY_BUFFER, geometria->vboCores);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(tpCor) * primeiro, sizeof(tpCor) * (ultimo - primeiro + 1), &geometria->cores[primeiro]);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @brief Desenha uma parte guardada na GPU com uma única chamada.
+ * @param geometria Geometria da parte, já atualizada.
+ * @param comCores true para usar as cores do gradiente; false usa a cor atual.
+ */
+void desenharGeometria(const tpGeometriaVBO *geometria, bool comCores){
+
+    glBindBuffer(GL_ARRAY_BUFFER, geometria->vboPontos);
+    glVertexPointer(2, GL_FLOAT, 0, (const GLvoid *)0);
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    if (comCores){
+
+        glBindBuffer(GL_ARRAY_BUFFER, geometria->vboCores);
+        glColorPointer(3, GL_UNSIGNED_BYTE, 0, (const GLvoid *)0);
+        glEnableClientState(GL_COLOR_ARRAY);
+    }
+
+    glDrawArrays(GL_POLYGON, 0, geometria->numPontos);
+
+    if (comCores) glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @brief Procura (ou calcula e envia à GPU) os vértices de uma elipse.
+ *
+ * Os vértices são os mesmos do desenho em modo imediato: o centro seguido de
+ * `segmentos + 1` pontos do contorno, prontos para um GL_TRIANGLE_FAN.
+ * Retorna NULL se a elipse não couber na tabela.
+ *
+ * @return tpElipseVBO* Elipse na GPU, ou NULL.
+ */
+tpElipseVBO *obterElipse(float centroX, float centroY, float raioX, float raioY, int segmentos, float anguloInclinacao){
+
+    for (int i = 0; i < numElipses; i++){
+
+        tpElipseVBO *e = &elipses[i];
+
+        if (e->centroX == centroX && e->centroY == centroY && e->raioX == raioX && e->raioY == raioY &&
+            e->segmentos == segmentos && e->anguloInclinacao == anguloInclinacao) return e;
+    }
+
+    if (numElipses == MAX_ELIPSES || segmentos > MAX_SEGMENTOS_ELIPSE) return NULL;
+
+    tpElipseVBO *elipse = &elipses[numElipses++];
+    tpPonto2D vertices[MAX_SEGMENTOS_ELIPSE + 2];
+    float inclinacao = anguloInclinacao _R;
+
+    elipse->centroX = centroX;
+    elipse->centroY = centroY;
+    elipse->raioX = raioX;
+    elipse->raioY = raioY;
+    elipse->segmentos = segmentos;
+    elipse->anguloInclinacao = anguloInclinacao;
+
+    vertices[0] = (tpPonto2D){centroX, centroY};
+
+    for (int i = 0; i <= segmentos; i++){
+
+        float angulo = 2.0f * M_PI * i / segmentos;
+        float x = cos(angulo) * raioX;
+        float y = sin(angulo) * raioY;
+
+        float xRot = x * cos(inclinacao) - y * sin(inclinacao);
+        float yRot = x * sin(inclinacao) + y * cos(inclinacao);
+
+        vertices[i + 1] = (tpPonto2D){centroX + xRot, centroY + yRot};
+    }
+
+    glGenBuffers(1, &elipse->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, elipse->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(tpPonto2D) * (segmentos + 2), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    return elipse;
+}
+
+//-----------------------------------------------------------------------------
+/**
+ * @brief Libera os buffers de vértices das partes e elipses.
+ *
+ * Assim como deletaTextura(), deve ser chamada ao fechar o programa.
+ */
+void liberarGeometrias(void){
+
+    for (int i = 0; i < numGeometrias; i++){
+
+        glDeleteBuffers(1, &geometrias[i].vboPontos);
+        if (geometrias[i].vboCores != 0) glDeleteBuffers(1, &geometrias[i].vboCores);
+    }
+
+    for (int i = 0; i < numElipses; i++) glDeleteBuffers(1, &elipses[i].vbo);
+
+    numGeometrias = 0;
+    numElipses = 0;
+}
+
 //-----------------------------------------------------------------------------
 /**
  * @brief Desenha uma linha reta entre dois pontos.
@@ -2000,6 +2305,7 @@ int main(int argc, char** argv) {
     glutReshapeFunc(remodelar);
 
     atexit(deletaTextura);
+    atexit(liberarGeometrias);
 
     glutMainLoop();
     return 0;